@@ -1,4 +1,5 @@
 #include "Path.h"
+#include "Profiler.h"
 #include <iostream>
 Path::Path(std::vector<Keyframe> _keyframes, std::shared_ptr<Helicopter> _heli)
 {
@@ -126,6 +127,7 @@ glm::quat Path::getCurrentRotation(float u)
 
 std::vector<std::pair<float, float>> Path::createParameterizationTable()
 {
+	PROFILE_SCOPE("Path::createParameterizationTable");
 	std::vector<std::pair<float, float>> usTable;
 	glm::mat4 G;
 	usTable.push_back(std::make_pair<float, float>(0, 0));
@@ -18,6 +18,7 @@
 #include "Helicopter.h"
 #include "Path.h"
 #include "Keyframe.h"
+#include "Profiler.h"
 
 using namespace std;
 
@@ -208,6 +209,7 @@ float get_u(float t, float tmax)
 
 void render()
 {
+	PROFILE_SCOPE("render");
 	// Update time.
 	double t = glfwGetTime();
 	
@@ -394,6 +396,7 @@ int main(int argc, char **argv)
 		glfwPollEvents();
 	}
 	// Quit program.
+	PROFILE_WRITE("trace.json");
 	glfwDestroyWindow(window);
 	glfwTerminate();
 	return 0;
@@ -10,6 +10,7 @@
 
 #include "ShapeSkin.h"
 #include "GLSL.h"
+#include "Profiler.h"
 #include "Program.h"
 #include "TextureMatrix.h"
 #include "Helpers.h"
@@ -185,6 +186,7 @@ void ShapeSkin::init()
 
 void ShapeSkin::update(int k)
 {
+	PROFILE_SCOPE("ShapeSkin::update");
 	// create new position and normal buffer
 	vector<float> posBuf2(posBuf.size());
 	vector<float> norBuf2(norBuf.size());
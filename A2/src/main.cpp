@@ -21,6 +21,7 @@
 #include "Texture.h"
 #include "TextureMatrix.h"
 #include "Bones.h"
+#include "Profiler.h"
 
 using namespace std;
 
@@ -212,6 +213,7 @@ void init()
 
 void render()
 {
+	PROFILE_SCOPE("render");
 	// Update time.
 	double t1 = glfwGetTime();
 	float dt = (t1 - t0);
@@ -485,6 +487,7 @@ int main(int argc, char **argv)
 		glfwPollEvents();
 	}
 	// Quit program.
+	PROFILE_WRITE("trace.json");
 	glfwDestroyWindow(window);
 	glfwTerminate();
 	return 0;
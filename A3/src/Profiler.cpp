@@ -0,0 +1,103 @@
+#include "Profiler.h"
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+using namespace std;
+
+namespace Profiler
+{
+	// One per thread. Only the owning thread writes; head is published with
+	// release order so that the exporter sees complete events.
+	struct Ring
+	{
+		Ring(int tid) : tid(tid), head(0), events(RING_SIZE) {}
+		int tid;
+		atomic<int64_t> head; // total number of events ever recorded
+		vector<Event> events;
+	};
+
+	static const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	static mutex ringsMutex;
+	static vector< shared_ptr<Ring> > rings; // keeps the rings of finished threads
+
+	static Ring &threadRing()
+	{
+		thread_local shared_ptr<Ring> ring;
+		if(!ring) {
+			lock_guard<mutex> lock(ringsMutex);
+			ring = make_shared<Ring>((int)rings.size());
+			rings.push_back(ring);
+		}
+		return *ring;
+	}
+
+	static void push(const Event &e)
+	{
+		Ring &ring = threadRing();
+		int64_t head = ring.head.load(memory_order_relaxed);
+		ring.events[head % RING_SIZE] = e;
+		ring.head.store(head + 1, memory_order_release);
+	}
+
+	int64_t now()
+	{
+		return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+	}
+
+	void record(const char *name, int64_t begin, int64_t end)
+	{
+		push(Event{name, begin, end, 0.0});
+	}
+
+	void counter(const char *name, double value)
+	{
+		push(Event{name, now(), -1, value});
+	}
+
+	void clear()
+	{
+		lock_guard<mutex> lock(ringsMutex);
+		for(auto ring : rings) {
+			ring->head.store(0, memory_order_release);
+		}
+	}
+
+	bool writeChromeTrace(const string &filename)
+	{
+		ofstream out(filename);
+		if(!out.good()) {
+			cerr << "Cannot write to " << filename << endl;
+			return false;
+		}
+		lock_guard<mutex> lock(ringsMutex);
+		out << fixed << setprecision(3);
+		out << "{\"traceEvents\":[";
+		bool first = true;
+		for(auto ring : rings) {
+			int64_t head = ring->head.load(memory_order_acquire);
+			int64_t tail = head > RING_SIZE ? head - RING_SIZE : 0;
+			for(int64_t k = tail; k < head; ++k) {
+				const Event &e = ring->events[k % RING_SIZE];
+				out << (first ? "\n" : ",\n");
+				first = false;
+				// Trace timestamps and durations are in microseconds
+				if(e.end < 0) {
+					out << "{\"name\":\"" << e.name << "\",\"ph\":\"C\",\"pid\":0,\"tid\":" << ring->tid;
+					out << ",\"ts\":" << e.begin*1e-3 << ",\"args\":{\"value\":" << e.value << "}}";
+				} else {
+					out << "{\"name\":\"" << e.name << "\",\"ph\":\"X\",\"pid\":0,\"tid\":" << ring->tid;
+					out << ",\"ts\":" << e.begin*1e-3 << ",\"dur\":" << (e.end - e.begin)*1e-3 << "}";
+				}
+			}
+		}
+		out << "\n]}\n";
+		return out.good();
+	}
+}
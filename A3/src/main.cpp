@@ -20,6 +20,7 @@
 #include "Shape.h"
 #include "BlendShape.h"
 #include "Texture.h"
+#include "Profiler.h"
 
 using namespace std;
 
@@ -176,6 +177,7 @@ void init()
 
 void render()
 {
+	PROFILE_SCOPE("render");
 	// Update time.
 	double t1 = glfwGetTime();
 	float dt = (t1 - t0);
@@ -351,6 +353,7 @@ int main(int argc, char **argv)
 		glfwPollEvents();
 	}
 	// Quit program.
+	PROFILE_WRITE("trace.json");
 	glfwDestroyWindow(window);
 	glfwTerminate();
 	return 0;
@@ -1,5 +1,6 @@
 #include "OptimizerNM.h"
 #include "Objective.h"
+#include "Profiler.h"
 #include <math.h>
 
 using namespace std;
@@ -28,6 +29,7 @@ OptimizerNM::~OptimizerNM()
 
 VectorXd OptimizerNM::optimize(const shared_ptr<Objective> objective, const VectorXd& xInit)
 {
+	PROFILE_SCOPE("OptimizerNM::optimize");
 	int n = xInit.rows();
 	VectorXd g(n);
 	MatrixXd H(n, n);
@@ -57,6 +59,7 @@ VectorXd OptimizerNM::optimize(const shared_ptr<Objective> objective, const Vect
 			break;
 		}
 	}
+	PROFILE_COUNTER("OptimizerNM iterations", iter);
 
 	return x;
 }
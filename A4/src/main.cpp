@@ -21,6 +21,7 @@
 #include "Objective.h"
 #include "OptimizerGDLS.h"
 #include "OptimizerNM.h"
+#include "Profiler.h"
 
 using namespace std;
 using namespace glm;
@@ -212,6 +213,7 @@ static void init()
 
 void render()
 {
+	PROFILE_SCOPE("render");
 	// Get current frame buffer size.
 	int width, height;
 	glfwGetFramebufferSize(window, &width, &height);
@@ -347,6 +349,7 @@ int main(int argc, char **argv)
 		glfwPollEvents();
 	}
 	// Quit program.
+	PROFILE_WRITE("trace.json");
 	glfwDestroyWindow(window);
 	glfwTerminate();
 	return 0;
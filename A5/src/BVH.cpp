@@ -0,0 +1,143 @@
+#include <algorithm>
+#include <cassert>
+
+#include "BVH.h"
+
+using namespace std;
+using namespace Eigen;
+
+// Maximum number of triangles in a leaf
+static const int LEAF_SIZE = 4;
+
+BVH::BVH()
+{
+}
+
+BVH::~BVH()
+{
+}
+
+void BVH::build(const Matrix3Xd &x, const vector<Vector3i> &tris)
+{
+	nodes.clear();
+	this->tris.clear();
+	if(tris.empty()) {
+		return;
+	}
+	vector<Vector3d> centroids(tris.size());
+	vector<int> order(tris.size());
+	for(int t = 0; t < (int)tris.size(); ++t) {
+		centroids[t] = (x.col(tris[t](0)) + x.col(tris[t](1)) + x.col(tris[t](2)))/3.0;
+		order[t] = t;
+	}
+	nodes.reserve(2*tris.size()/LEAF_SIZE + 1);
+	buildNode(centroids, order, 0, (int)tris.size());
+	this->tris.resize(tris.size());
+	for(int t = 0; t < (int)tris.size(); ++t) {
+		this->tris[t] = tris[order[t]];
+	}
+	refit(x, 0.0);
+}
+
+int BVH::buildNode(const vector<Vector3d> &centroids, vector<int> &order, int start, int count)
+{
+	int index = (int)nodes.size();
+	Node node;
+	node.lo.setZero();
+	node.hi.setZero();
+	node.left = node.right = -1;
+	node.start = start;
+	node.count = count;
+	nodes.push_back(node);
+	if(count <= LEAF_SIZE) {
+		return index;
+	}
+	
+	// Median split along the longest axis of the centroid bounds
+	Vector3d lo = centroids[order[start]];
+	Vector3d hi = lo;
+	for(int i = start + 1; i < start + count; ++i) {
+		lo = lo.cwiseMin(centroids[order[i]]);
+		hi = hi.cwiseMax(centroids[order[i]]);
+	}
+	int axis;
+	(hi - lo).maxCoeff(&axis);
+	int mid = start + count/2;
+	nth_element(order.begin() + start, order.begin() + mid, order.begin() + start + count, [&](int a, int b) {
+		return centroids[a](axis) < centroids[b](axis);
+	});
+	
+	int left = buildNode(centroids, order, start, mid - start);
+	int right = buildNode(centroids, order, mid, start + count - mid);
+	nodes[index].left = left;
+	nodes[index].right = right;
+	nodes[index].count = 0;
+	return index;
+}
+
+void BVH::refit(const Matrix3Xd &x, double pad)
+{
+	// Children are stored after their parents, so a reverse sweep is bottom-up
+	for(int i = (int)nodes.size() - 1; i >= 0; --i) {
+		Node &node = nodes[i];
+		if(node.count > 0) {
+			node.lo = x.col(tris[node.start](0));
+			node.hi = node.lo;
+			for(int t = node.start; t < node.start + node.count; ++t) {
+				for(int k = 0; k < 3; ++k) {
+					node.lo = node.lo.cwiseMin(x.col(tris[t](k)));
+					node.hi = node.hi.cwiseMax(x.col(tris[t](k)));
+				}
+			}
+			node.lo.array() -= pad;
+			node.hi.array() += pad;
+		} else {
+			node.lo = nodes[node.left].lo.cwiseMin(nodes[node.right].lo);
+			node.hi = nodes[node.left].hi.cwiseMax(nodes[node.right].hi);
+		}
+	}
+}
+
+// Ericson, Real-Time Collision Detection, 5.1.5
+Vector3d closestPointTriangle(const Vector3d &p, const Vector3d &a, const Vector3d &b, const Vector3d &c)
+{
+	Vector3d ab = b - a;
+	Vector3d ac = c - a;
+	Vector3d ap = p - a;
+	double d1 = ab.dot(ap);
+	double d2 = ac.dot(ap);
+	if(d1 <= 0.0 && d2 <= 0.0) {
+		return Vector3d(1.0, 0.0, 0.0);
+	}
+	Vector3d bp = p - b;
+	double d3 = ab.dot(bp);
+	double d4 = ac.dot(bp);
+	if(d3 >= 0.0 && d4 <= d3) {
+		return Vector3d(0.0, 1.0, 0.0);
+	}
+	double vc = d1*d4 - d3*d2;
+	if(vc <= 0.0 && d1 >= 0.0 && d3 <= 0.0) {
+		double v = d1/(d1 - d3);
+		return Vector3d(1.0 - v, v, 0.0);
+	}
+	Vector3d cp = p - c;
+	double d5 = ab.dot(cp);
+	double d6 = ac.dot(cp);
+	if(d6 >= 0.0 && d5 <= d6) {
+		return Vector3d(0.0, 0.0, 1.0);
+	}
+	double vb = d5*d2 - d1*d6;
+	if(vb <= 0.0 && d2 >= 0.0 && d6 <= 0.0) {
+		double w = d2/(d2 - d6);
+		return Vector3d(1.0 - w, 0.0, w);
+	}
+	double va = d3*d6 - d5*d4;
+	if(va <= 0.0 && (d4 - d3) >= 0.0 && (d5 - d6) >= 0.0) {
+		double w = (d4 - d3)/((d4 - d3) + (d5 - d6));
+		return Vector3d(0.0, 1.0 - w, w);
+	}
+	double denom = 1.0/(va + vb + vc);
+	double v = vb*denom;
+	double w = vc*denom;
+	return Vector3d(1.0 - v - w, v, w);
+}
@@ -0,0 +1,74 @@
+#pragma once
+#ifndef BVH_H
+#define BVH_H
+
+#include <vector>
+
+#define EIGEN_DONT_ALIGN_STATICALLY
+#include <Eigen/Dense>
+
+/**
+ * Axis-aligned bounding box hierarchy over a fixed set of triangles.
+ * The tree topology is built once from the initial positions; afterwards
+ * only the boxes are refit bottom-up from the current positions, which is
+ * linear in the number of nodes.
+ */
+class BVH
+{
+public:
+	BVH();
+	virtual ~BVH();
+	
+	void build(const Eigen::Matrix3Xd &x, const std::vector<Eigen::Vector3i> &tris);
+	// Recomputes the boxes from positions x, grown by pad on every side
+	void refit(const Eigen::Matrix3Xd &x, double pad);
+	
+	// Calls visit(t) for every triangle t whose box overlaps [lo, hi]
+	template<typename Visitor>
+	void query(const Eigen::Vector3d &lo, const Eigen::Vector3d &hi, Visitor visit) const
+	{
+		if(nodes.empty()) {
+			return;
+		}
+		int stack[64];
+		int top = 0;
+		stack[top++] = 0;
+		while(top > 0) {
+			const Node &node = nodes[stack[--top]];
+			if((node.hi.array() < lo.array()).any() || (node.lo.array() > hi.array()).any()) {
+				continue;
+			}
+			if(node.count > 0) {
+				for(int t = node.start; t < node.start + node.count; ++t) {
+					visit(tris[t]);
+				}
+			} else {
+				stack[top++] = node.left;
+				stack[top++] = node.right;
+			}
+		}
+	}
+	
+	int getNumNodes() const { return (int)nodes.size(); }
+	
+private:
+	struct Node
+	{
+		Eigen::Vector3d lo;
+		Eigen::Vector3d hi;
+		int left;  // child nodes, if internal
+		int right;
+		int start; // range of triangles, if leaf
+		int count;
+	};
+	
+	int buildNode(const std::vector<Eigen::Vector3d> &centroids, std::vector<int> &order, int start, int count);
+	
+	std::vector<Node> nodes;           // children always come after their parent
+	std::vector<Eigen::Vector3i> tris; // reordered so that each leaf is a contiguous range
+};
+
+// Closest point to p on triangle abc, returned as barycentric weights
+Eigen::Vector3d closestPointTriangle(const Eigen::Vector3d &p, const Eigen::Vector3d &a, const Eigen::Vector3d &b, const Eigen::Vector3d &c);
+
+#endif
@@ -0,0 +1,106 @@
+#pragma once
+#ifndef BufferUploader_H
+#define BufferUploader_H
+
+#include <cstddef>
+#include <cstring>
+#include <vector>
+
+/**
+ * Uploads the per-frame vertex data of a deforming mesh and draws it. Each
+ * vertex is one interleaved record of position (3 floats) followed by normal
+ * (3 floats). The element indices never change and are uploaded once by
+ * init(). Strips may be separated by RESTART_INDEX so that a whole sheet is
+ * drawn with a single call.
+ */
+class BufferUploader
+{
+public:
+	enum Primitive
+	{
+		TRIANGLES,
+		TRIANGLE_STRIP
+	};
+
+	static constexpr unsigned int RESTART_INDEX = 0xffffffffu;
+	static constexpr int FLOATS_PER_VERTEX = 6;
+	static constexpr size_t VERTEX_BYTES = FLOATS_PER_VERTEX*sizeof(float);
+
+	virtual ~BufferUploader() {}
+
+	virtual void init(int nVerts, const std::vector<unsigned int> &elements, Primitive primitive) = 0;
+	// Copies one frame of positions and normals (3 floats per vertex each)
+	virtual void upload(const float *pos, const float *nor) = 0;
+	// Draws the most recently uploaded frame with the given vertex attributes
+	virtual void draw(int posAttrib, int norAttrib) = 0;
+
+protected:
+	static void interleave(float *dst, const float *pos, const float *nor, int nVerts)
+	{
+		for(int k = 0; k < nVerts; ++k) {
+			memcpy(dst + FLOATS_PER_VERTEX*k, pos + 3*k, 3*sizeof(float));
+			memcpy(dst + FLOATS_PER_VERTEX*k + 3, nor + 3*k, 3*sizeof(float));
+		}
+	}
+};
+
+// Headless stand-in that keeps the interleaved data in memory and counts what
+// would have been sent to the GPU
+class MockBufferUploader : public BufferUploader
+{
+public:
+	MockBufferUploader() :
+		nVerts(0),
+		primitive(TRIANGLES),
+		elementBytes(0),
+		uploadBytes(0),
+		uploads(0),
+		draws(0),
+		restarts(0)
+	{
+	}
+
+	void init(int nVerts, const std::vector<unsigned int> &elements, Primitive primitive)
+	{
+		this->nVerts = nVerts;
+		this->elements = elements;
+		this->primitive = primitive;
+		vertices.assign(FLOATS_PER_VERTEX*nVerts, 0.0f);
+		elementBytes += elements.size()*sizeof(unsigned int);
+		restarts = 0;
+		for(unsigned int e : elements) {
+			restarts += e == RESTART_INDEX;
+		}
+	}
+
+	void upload(const float *pos, const float *nor)
+	{
+		interleave(&vertices[0], pos, nor, nVerts);
+		uploadBytes += nVerts*VERTEX_BYTES;
+		++uploads;
+	}
+
+	void draw(int /*posAttrib*/, int /*norAttrib*/) { ++draws; }
+
+	const std::vector<float> &getVertices() const { return vertices; }
+	const std::vector<unsigned int> &getElements() const { return elements; }
+	Primitive getPrimitive() const { return primitive; }
+	size_t getElementBytes() const { return elementBytes; }
+	size_t getUploadBytes() const { return uploadBytes; }
+	int getUploads() const { return uploads; }
+	int getDraws() const { return draws; }
+	int getRestarts() const { return restarts; }
+
+private:
+	int nVerts;
+	std::vector<float> vertices;
+	std::vector<unsigned int> elements;
+	Primitive primitive;
+	size_t elementBytes;
+	size_t uploadBytes;
+	int uploads;
+	int draws;
+	int restarts;
+};
+
+#endif
@@ -0,0 +1,145 @@
+#pragma once
+#ifndef ChebyshevSolver_H
+#define ChebyshevSolver_H
+
+#include <algorithm>
+#include <cmath>
+
+#define EIGEN_DONT_ALIGN_STATICALLY
+#include <Eigen/Dense>
+
+/**
+ * Preconditioned Chebyshev semi-iteration (Saad, Iterative Methods for
+ * Sparse Linear Systems, Alg. 12.1) for an SPD system A x = b. Unlike CG
+ * it needs no inner products, but it needs bounds on the spectrum of
+ * P^-1 A. They are estimated with power iterations and then kept across
+ * solves, since the cloth system changes slowly from step to step. The
+ * owner invalidates them when the system changes for good (a new time step
+ * or stiffness); a solve that diverges, which means the bounds no longer
+ * hold, also invalidates them.
+ *
+ * MatType needs operator* with a VectorXd, and Precond needs
+ * solve(VectorXd) (e.g. BlockJacobiPreconditioner).
+ */
+class ChebyshevSolver
+{
+public:
+	ChebyshevSolver() :
+		iterMax(25),
+		tol(1e-6),
+		powerIterations(10),
+		valid(false),
+		lambdaMin(0.0),
+		lambdaMax(0.0),
+		iter(0),
+		estimateIter(0),
+		err(0.0)
+	{}
+
+	void setMaxIterations(int iterMax) { this->iterMax = iterMax; }
+	void setTolerance(double tol) { this->tol = tol; }
+	// Forces a new spectrum estimate on the next solve
+	void invalidate() { valid = false; }
+
+	// Chebyshev iterations of the last solve
+	int iterations() const { return iter; }
+	// Operator products spent on the spectrum estimate in the last solve
+	int estimateIterations() const { return estimateIter; }
+	double error() const { return err; }
+	bool converged() const { return err < tol; }
+	double getLambdaMin() const { return lambdaMin; }
+	double getLambdaMax() const { return lambdaMax; }
+
+	template<typename MatType, typename Precond>
+	Eigen::VectorXd solveWithGuess(const MatType &A, const Precond &P, const Eigen::VectorXd &b, const Eigen::VectorXd &guess)
+	{
+		estimateIter = 0;
+		if(!valid || uMax.size() != b.size()) {
+			estimate(A, P);
+			valid = true;
+		}
+
+		Eigen::VectorXd x = guess;
+		Eigen::VectorXd r = b - A*x;
+		double bnorm = b.norm();
+		if(bnorm == 0.0) {
+			bnorm = 1.0;
+		}
+		err = r.norm()/bnorm;
+		iter = 0;
+		double rnorm0 = err;
+
+		// The power iterations approach lambdaMax from below and lambdaMin from
+		// above, and either error can make the iteration diverge, so both ends
+		// get some slack
+		double beta = 1.1*lambdaMax;
+		double alpha = 0.8*lambdaMin;
+		double theta = 0.5*(beta + alpha);
+		double delta = 0.5*(beta - alpha);
+		double sigma = theta/delta;
+		double rho = 1.0/sigma;
+		Eigen::VectorXd d = P.solve(r);
+		d /= theta;
+		while(err >= tol && iter < iterMax) {
+			x += d;
+			r -= A*d;
+			++iter;
+			err = r.norm()/bnorm;
+			double rhoNext = 1.0/(2.0*sigma - rho);
+			Eigen::VectorXd z = P.solve(r);
+			d = (rhoNext*rho)*d + (2.0*rhoNext/delta)*z;
+			rho = rhoNext;
+			if(!(err < 1e2*rnorm0)) {
+				break;
+			}
+		}
+		if(iter > 0 && !(err < rnorm0)) {
+			invalidate();
+		}
+		return x;
+	}
+
+private:
+	// Power iterations for the largest eigenvalue of P^-1 A, then of
+	// I - P^-1 A / lambdaMax for the smallest one
+	template<typename MatType, typename Precond>
+	void estimate(const MatType &A, const Precond &P)
+	{
+		int n = (int)A.rows();
+		if(uMax.size() != n) {
+			uMax.setOnes(n);
+			uMin = Eigen::VectorXd::LinSpaced(n, -1.0, 1.0);
+		}
+		Eigen::VectorXd Au(n);
+		Eigen::VectorXd w(n);
+		for(int k = 0; k < powerIterations; ++k) {
+			Au = A*uMax;
+			w = P.solve(Au);
+			lambdaMax = w.norm()/uMax.norm();
+			uMax = w/w.norm();
+		}
+		double mu = 0.0;
+		for(int k = 0; k < powerIterations; ++k) {
+			Au = A*uMin;
+			w = uMin - P.solve(Au)/lambdaMax;
+			mu = w.norm()/uMin.norm();
+			uMin = w/w.norm();
+		}
+		lambdaMin = std::max(lambdaMax*(1.0 - mu), 1e-3*lambdaMax);
+		estimateIter = 2*powerIterations;
+	}
+
+	int iterMax;
+	double tol;
+	int powerIterations;
+	bool valid;
+	double lambdaMin;
+	double lambdaMax;
+	Eigen::VectorXd uMax;
+	Eigen::VectorXd uMin;
+	int iter;
+	int estimateIter;
+	double err;
+};
+
+#endif
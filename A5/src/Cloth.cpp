@@ -1,37 +1,64 @@
 #include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <fstream>
 
-#define GLM_FORCE_RADIANS
-#include <glm/glm.hpp>
-#include <glm/gtc/type_ptr.hpp>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#include "tiny_obj_loader.h"
 
 #include "Cloth.h"
+#include "ClothOperator.h"
+#include "ClothPreconditioner.h"
+#include "ChebyshevSolver.h"
+#include "SpatialHash.h"
+#include "BVH.h"
+#include "DistanceField.h"
+#include "MappedFile.h"
 #include "Particle.h"
-#include "Spring.h"
-#include "MatrixStack.h"
-#include "Program.h"
-#include "GLSL.h"
+#include "Profiler.h"
 
 using namespace std;
 using namespace Eigen;
 
-shared_ptr<Spring> createSpring(const shared_ptr<Particle> p0, const shared_ptr<Particle> p1, double E)
+typedef chrono::steady_clock Clock;
+
+// Seconds since t, and restarts t
+static double lap(Clock::time_point &t)
 {
-	auto s = make_shared<Spring>(p0, p1);
-	s->E = E;
-	Vector3d x0 = p0->x;
-	Vector3d x1 = p1->x;
-	Vector3d dx = x1 - x0;
-	s->L = dx.norm();
+	Clock::time_point now = Clock::now();
+	double s = chrono::duration<double>(now - t).count();
+	t = now;
 	return s;
 }
 
+// Stiffness of the sphere contact penalty
+static const double COLLISION_STIFFNESS = 1e1;
+
+static Spring createSpring(const Matrix3Xd &pos, int i0, int i1, double E)
+{
+	Vector3d dx = pos.col(i1) - pos.col(i0);
+	return Spring(i0, i1, E, dx.norm());
+}
+
 Cloth::Cloth(int rows, int cols,
 			 const Vector3d &x00,
 			 const Vector3d &x01,
 			 const Vector3d &x10,
 			 const Vector3d &x11,
 			 double mass,
-			 double stiffness)
+			 double stiffness,
+			 Integrator integrator)
 {
 	assert(rows > 1);
 	assert(cols > 1);
@@ -40,42 +67,46 @@ Cloth::Cloth(int rows, int cols,
 	
 	this->rows = rows;
 	this->cols = cols;
+	setDefaults(integrator);
 	
 	// Create particles
 	n = 0;
-	double r = 0.02; // Used for collisions
+	r = 0.02; // Used for collisions
 	int nVerts = rows*cols;
+	pos.resize(3, nVerts);
+	vel.setZero(3, nVerts);
+	m.resize(nVerts);
+	dofs.resize(nVerts);
+	fixed.resize(nVerts);
 	for(int i = 0; i < rows; ++i) {
 		double u = i / (rows - 1.0);
 		Vector3d x0 = (1 - u)*x00 + u*x10;
 		Vector3d x1 = (1 - u)*x01 + u*x11;
 		for(int j = 0; j < cols; ++j) {
 			double v = j / (cols - 1.0);
-			Vector3d x = (1 - v)*x0 + v*x1;
-			auto p = make_shared<Particle>();
-			particles.push_back(p);
-			p->r = r;
-			p->x = x;
-			p->v << 0.0, 0.0, 0.0;
-			p->m = mass/(nVerts);
+			int k = i*cols + j;
+			pos.col(k) = (1 - v)*x0 + v*x1;
+			m(k) = mass/(nVerts);
 			// Pin two particles
 			if(i == 0 && (j == 0 || j == cols-1)) {
-				p->fixed = true;
-				p->i = -1;
+				fixed[k] = true;
+				dofs[k] = -1;
 			} else {
-				p->fixed = false;
-				p->i = n;
+				fixed[k] = false;
+				dofs[k] = n;
 				n += 3;
 			}
 		}
 	}
+	pos0 = pos;
+	vel0 = vel;
 	
 	// Create x springs
 	for(int i = 0; i < rows; ++i) {
 		for(int j = 0; j < cols-1; ++j) {
 			int k0 = i*cols + j;
 			int k1 = k0 + 1;
-			springs.push_back(createSpring(particles[k0], particles[k1], stiffness));
+			springs.push_back(createSpring(pos, k0, k1, stiffness));
 		}
 	}
 	
@@ -84,7 +115,7 @@ Cloth::Cloth(int rows, int cols,
 		for(int i = 0; i < rows-1; ++i) {
 			int k0 = i*cols + j;
 			int k1 = k0 + cols;
-			springs.push_back(createSpring(particles[k0], particles[k1], stiffness));
+			springs.push_back(createSpring(pos, k0, k1, stiffness));
 		}
 	}
 	
@@ -95,8 +126,8 @@ Cloth::Cloth(int rows, int cols,
 			int k10 = k00 + 1;
 			int k01 = k00 + cols;
 			int k11 = k01 + 1;
-			springs.push_back(createSpring(particles[k00], particles[k11], stiffness));
-			springs.push_back(createSpring(particles[k10], particles[k01], stiffness));
+			springs.push_back(createSpring(pos, k00, k11, stiffness));
+			springs.push_back(createSpring(pos, k10, k01, stiffness));
 		}
 	}
 	
@@ -105,7 +136,7 @@ Cloth::Cloth(int rows, int cols,
 		for(int j = 0; j < cols-2; ++j) {
 			int k0 = i*cols + j;
 			int k2 = k0 + 2;
-			springs.push_back(createSpring(particles[k0], particles[k2], stiffness));
+			springs.push_back(createSpring(pos, k0, k2, stiffness));
 		}
 	}
 	
@@ -114,24 +145,12 @@ Cloth::Cloth(int rows, int cols,
 		for(int i = 0; i < rows-2; ++i) {
 			int k0 = i*cols + j;
 			int k2 = k0 + 2*cols;
-			springs.push_back(createSpring(particles[k0], particles[k2], stiffness));
+			springs.push_back(createSpring(pos, k0, k2, stiffness));
 		}
 	}
 
-	// Build system matrices and vectors
-	M.resize(n,n);
-	K.resize(n,n);
-	v.resize(n);
-	f.resize(n);
-	
-	// Build vertex buffers
-	posBuf.clear();
-	norBuf.clear();
-	texBuf.clear();
-	eleBuf.clear();
-	posBuf.resize(nVerts*3);
-	norBuf.resize(nVerts*3);
-	updatePosNor();
+	colorSprings();
+	setup(stiffness);
 
 	// Texture coordinates (don't change)
 	for(int i = 0; i < rows; ++i) {
@@ -143,6 +162,9 @@ Cloth::Cloth(int rows, int cols,
 
 	// Elements (don't change)
 	for(int i = 0; i < rows-1; ++i) {
+		if(i > 0) {
+			eleBuf.push_back(BufferUploader::RESTART_INDEX);
+		}
 		for(int j = 0; j < cols; ++j) {
 			int k0 = i*cols + j;
 			int k1 = k0 + cols;
@@ -151,285 +173,1952 @@ Cloth::Cloth(int rows, int cols,
 			eleBuf.push_back(k1);
 		}
 	}
+	
+	// Triangles of the strips, for self-collision
+	for(int i = 0; i < rows-1; ++i) {
+		const unsigned int *strip = &eleBuf[(2*cols + 1)*i];
+		for(int t = 0; t + 2 < 2*cols; ++t) {
+			tris.push_back(Vector3i(strip[t], strip[t+1], strip[t+2]));
+		}
+	}
+}
+
+// An edge of a triangle (a < b) and the triangle's vertex opposite to it
+struct MeshEdge
+{
+	int a, b, opp;
+	bool operator<(const MeshEdge &e) const { return a < e.a || (a == e.a && b < e.b); }
+};
+
+// Edges of every triangle, sorted so that the triangles sharing an edge are
+// next to each other
+static vector<MeshEdge> meshEdges(const vector<Vector3i> &tris)
+{
+	vector<MeshEdge> edges;
+	edges.reserve(3*tris.size());
+	for(const Vector3i &t : tris) {
+		for(int e = 0; e < 3; ++e) {
+			int a = t((e+1)%3);
+			int b = t((e+2)%3);
+			edges.push_back(MeshEdge{min(a, b), max(a, b), t(e)});
+		}
+	}
+	sort(edges.begin(), edges.end());
+	return edges;
+}
+
+// Last vertex reached by a breadth-first search from root, preferring low
+// degree, over the vertices not yet ordered. Vertices are marked visited by
+// setting seen to stamp, so seen never needs clearing.
+static int farthestVertex(int root, const vector<int> &adjStart, const vector<int> &adj, const vector<char> &ordered,
+						  vector<int> &seen, int stamp)
+{
+	vector<int> level(1, root);
+	seen[root] = stamp;
+	int last = root;
+	while(!level.empty()) {
+		last = level.front();
+		for(int k : level) {
+			if(adjStart[k+1] - adjStart[k] < adjStart[last+1] - adjStart[last]) {
+				last = k;
+			}
+		}
+		vector<int> next;
+		for(int k : level) {
+			for(int a = adjStart[k]; a < adjStart[k+1]; ++a) {
+				if(!ordered[adj[a]] && seen[adj[a]] != stamp) {
+					seen[adj[a]] = stamp;
+					next.push_back(adj[a]);
+				}
+			}
+		}
+		level.swap(next);
+	}
+	return last;
+}
+
+// Reverse Cuthill-McKee ordering of a graph in compressed adjacency form.
+// Returns the new index of every vertex. Each connected component starts
+// from a pseudo-peripheral vertex (two breadth-first sweeps).
+static vector<int> reverseCuthillMcKee(const vector<int> &adjStart, const vector<int> &adj)
+{
+	int nVerts = (int)adjStart.size() - 1;
+	vector<int> order;
+	order.reserve(nVerts);
+	vector<char> ordered(nVerts, 0);
+	vector<int> seen(nVerts, -1);
+	int stamp = 0;
+	for(int k = 0; k < nVerts; ++k) {
+		if(ordered[k]) {
+			continue;
+		}
+		int root = farthestVertex(k, adjStart, adj, ordered, seen, stamp++);
+		root = farthestVertex(root, adjStart, adj, ordered, seen, stamp++);
+		size_t head = order.size();
+		order.push_back(root);
+		ordered[root] = 1;
+		vector<int> nbrs;
+		for(; head < order.size(); ++head) {
+			int q = order[head];
+			nbrs.clear();
+			for(int a = adjStart[q]; a < adjStart[q+1]; ++a) {
+				if(!ordered[adj[a]]) {
+					nbrs.push_back(adj[a]);
+					ordered[adj[a]] = 1;
+				}
+			}
+			sort(nbrs.begin(), nbrs.end(), [&](int i, int j) {
+				return adjStart[i+1] - adjStart[i] < adjStart[j+1] - adjStart[j];
+			});
+			order.insert(order.end(), nbrs.begin(), nbrs.end());
+		}
+	}
+	vector<int> newIndex(nVerts);
+	for(int k = 0; k < nVerts; ++k) {
+		newIndex[order[nVerts-1-k]] = k;
+	}
+	return newIndex;
+}
+
+Cloth::Cloth(const string &meshName,
+			 const vector<int> &pinned,
+			 double mass,
+			 double stiffness,
+			 Integrator integrator)
+{
+	assert(mass > 0.0);
+	assert(stiffness > 0.0);
+	
+	rows = 0;
+	cols = 0;
+	setDefaults(integrator);
+	
+	// Load the triangles. Unlike Shape, vertices are shared by position index
+	// so that the triangles are connected; each vertex keeps the first
+	// texture coordinate it is seen with.
+	tinyobj::attrib_t attrib;
+	std::vector<tinyobj::shape_t> shapes;
+	std::vector<tinyobj::material_t> materials;
+	string errStr;
+	bool rc = tinyobj::LoadObj(&attrib, &shapes, &materials, &errStr, meshName.c_str());
+	if(!rc) {
+		cerr << errStr << endl;
+	}
+	vector<int> local(attrib.vertices.size()/3, -1);
+	vector<int> objIndex;
+	vector<float> tex;
+	for(size_t sh = 0; sh < shapes.size(); ++sh) {
+		const tinyobj::mesh_t &mesh = shapes[sh].mesh;
+		size_t index_offset = 0;
+		for(size_t fc = 0; fc < mesh.num_face_vertices.size(); ++fc) {
+			size_t fv = mesh.num_face_vertices[fc];
+			const tinyobj::index_t *idx = &mesh.indices[index_offset];
+			index_offset += fv;
+			// Triangles only (tinyobj triangulates), and no degenerate ones.
+			// Vertices are numbered only once a triangle is kept, so that
+			// every particle has some mass.
+			if(fv != 3 || idx[0].vertex_index == idx[1].vertex_index ||
+			   idx[1].vertex_index == idx[2].vertex_index || idx[2].vertex_index == idx[0].vertex_index) {
+				continue;
+			}
+			Vector3i t;
+			for(int v = 0; v < 3; ++v) {
+				int &k = local[idx[v].vertex_index];
+				if(k < 0) {
+					k = (int)objIndex.size();
+					objIndex.push_back(idx[v].vertex_index);
+					bool hasTex = !attrib.texcoords.empty() && idx[v].texcoord_index >= 0;
+					tex.push_back(hasTex ? attrib.texcoords[2*idx[v].texcoord_index+0] : 0.0f);
+					tex.push_back(hasTex ? attrib.texcoords[2*idx[v].texcoord_index+1] : 0.0f);
+				}
+				t(v) = k;
+			}
+			tris.push_back(t);
+		}
+	}
+	assert(!tris.empty());
+	int nVerts = (int)objIndex.size();
+	
+	// Renumber the vertices in reverse Cuthill-McKee order of the mesh edges,
+	// which keeps the bandwidth of the system matrix, and so the distance in
+	// memory between coupled particles, low
+	vector<MeshEdge> edges = meshEdges(tris);
+	vector< vector<int> > nbrs(nVerts);
+	for(const MeshEdge &e : edges) {
+		nbrs[e.a].push_back(e.b);
+		nbrs[e.b].push_back(e.a);
+	}
+	vector<int> adjStart(1, 0);
+	vector<int> adj;
+	for(int k = 0; k < nVerts; ++k) {
+		sort(nbrs[k].begin(), nbrs[k].end());
+		nbrs[k].erase(unique(nbrs[k].begin(), nbrs[k].end()), nbrs[k].end());
+		adj.insert(adj.end(), nbrs[k].begin(), nbrs[k].end());
+		adjStart.push_back((int)adj.size());
+	}
+	vector<int> newIndex = reverseCuthillMcKee(adjStart, adj);
+	for(Vector3i &t : tris) {
+		t = Vector3i(newIndex[t(0)], newIndex[t(1)], newIndex[t(2)]);
+	}
+	
+	// Create particles, with the mass lumped by a third of the adjacent
+	// triangle areas
+	n = 0;
+	r = 0.02; // Used for collisions
+	pos.resize(3, nVerts);
+	vel.setZero(3, nVerts);
+	m.setZero(nVerts);
+	dofs.resize(nVerts);
+	fixed.assign(nVerts, false);
+	texBuf.resize(2*nVerts);
+	for(int k = 0; k < nVerts; ++k) {
+		int o = objIndex[k];
+		int kk = newIndex[k];
+		pos.col(kk) << attrib.vertices[3*o+0], attrib.vertices[3*o+1], attrib.vertices[3*o+2];
+		texBuf[2*kk+0] = tex[2*k+0];
+		texBuf[2*kk+1] = tex[2*k+1];
+	}
+	double area = 0.0;
+	for(const Vector3i &t : tris) {
+		double a = 0.5*(pos.col(t(1)) - pos.col(t(0))).cross(pos.col(t(2)) - pos.col(t(0))).norm();
+		for(int i = 0; i < 3; ++i) {
+			m(t(i)) += a/3.0;
+		}
+		area += a;
+	}
+	m *= mass/area;
+	for(int o : pinned) {
+		if(o >= 0 && o < (int)local.size() && local[o] >= 0) {
+			fixed[newIndex[local[o]]] = true;
+		}
+	}
+	for(int k = 0; k < nVerts; ++k) {
+		if(fixed[k]) {
+			dofs[k] = -1;
+		} else {
+			dofs[k] = n;
+			n += 3;
+		}
+	}
+	pos0 = pos;
+	vel0 = vel;
+	
+	// Stretch springs along the edges, and bending springs across each edge
+	// shared by two triangles, between the vertices opposite to it
+	edges = meshEdges(tris);
+	vector<Spring> bending;
+	for(size_t e = 0; e < edges.size(); ) {
+		size_t end = e + 1;
+		while(end < edges.size() && edges[end].a == edges[e].a && edges[end].b == edges[e].b) {
+			++end;
+		}
+		springs.push_back(createSpring(pos, edges[e].a, edges[e].b, stiffness));
+		if(end - e == 2 && edges[e].opp != edges[e+1].opp) {
+			int i0 = min(edges[e].opp, edges[e+1].opp);
+			int i1 = max(edges[e].opp, edges[e+1].opp);
+			bending.push_back(createSpring(pos, i0, i1, stiffness));
+		}
+		e = end;
+	}
+	springs.insert(springs.end(), bending.begin(), bending.end());
+	
+	// Triangles around each vertex, for the normals
+	vertTriStart.assign(nVerts + 1, 0);
+	for(const Vector3i &t : tris) {
+		for(int i = 0; i < 3; ++i) {
+			++vertTriStart[t(i) + 1];
+		}
+	}
+	for(int k = 0; k < nVerts; ++k) {
+		vertTriStart[k + 1] += vertTriStart[k];
+	}
+	vertTris.resize(vertTriStart.back());
+	vector<int> next(vertTriStart.begin(), vertTriStart.end() - 1);
+	for(int t = 0; t < (int)tris.size(); ++t) {
+		for(int i = 0; i < 3; ++i) {
+			vertTris[next[tris[t](i)]++] = t;
+		}
+	}
+	triNor.resize(3, tris.size());
+	
+	colorSprings();
+	setup(stiffness);
+	
+	// Elements (don't change)
+	for(const Vector3i &t : tris) {
+		eleBuf.push_back(t(0));
+		eleBuf.push_back(t(1));
+		eleBuf.push_back(t(2));
+	}
+}
+
+// For loadCheckpoint(), which fills in everything itself
+Cloth::Cloth()
+{
 }
 
 Cloth::~Cloth()
 {
 }
 
-void Cloth::tare()
+// Solver and collision settings shared by both constructors
+void Cloth::setDefaults(Integrator integrator)
+{
+	this->integrator = integrator;
+	matrixFree = false;
+	buffersOnDemand = false;
+#ifdef _OPENMP
+	nThreads = omp_get_max_threads();
+#else
+	nThreads = 1;
+#endif
+	solver = CONJUGATE_GRADIENT;
+	chebyshev = make_shared<ChebyshevSolver>();
+	precond = JACOBI;
+	precision = DOUBLE_PRECISION;
+	iterMax = 25;
+	tol = 1e-6;
+	iter = 0;
+	estimateIter = 0;
+	err = 0.0;
+	chebyshevH = 0.0;
+	maxStrainRate = 0.0;
+	maxPenetration = 0.0;
+	ccd = true;
+	nSweptContacts = 0;
+	timings = Timings();
+}
+
+// Everything that only needs the particles and the colored springs: system
+// pattern, matrix-free operator, collision defaults, and the frame buffers
+void Cloth::setup(double stiffness)
+{
+	int nVerts = (int)pos.cols();
+
+	// Build system matrices and vectors
+	v.setZero(n);
+	f.resize(n);
+	if(integrator == IMPLICIT_EULER) {
+		Clock::time_point t = Clock::now();
+		buildPattern();
+		timings.pattern = lap(t);
+	}
+	pdIterations = 10;
+	pdH = 0.0;
+	vector<int> springDofs0, springDofs1;
+	for(const Spring &s : springs) {
+		springDofs0.push_back(dofs[s.i0]);
+		springDofs1.push_back(dofs[s.i1]);
+	}
+	op = make_shared<ClothOperator>();
+	op->init(n, springDofs0, springDofs1, colorStart);
+	op->setNumThreads(nThreads);
+	sphereHash = make_shared<SpatialHash>();
+	sweptHash = make_shared<SpatialHash>();
+	
+	// Self-collision defaults: half the shortest rest length, and the cloth stiffness
+	selfCollision = false;
+	selfThickness = springs.front().L;
+	for(const Spring &s : springs) {
+		selfThickness = min(selfThickness, s.L);
+	}
+	selfThickness *= 0.5;
+	selfStiffness = stiffness;
+	nSelfContacts = 0;
+	
+	// Build vertex buffers
+	Frame frame;
+	frame.posBuf.resize(nVerts*3);
+	frame.norBuf.resize(nVerts*3);
+	frames = make_shared< TripleBuffer<Frame> >();
+	frames->reset(frame);
+	updatePosNor();
+}
+
+void Cloth::colorSprings()
 {
-	for(int k = 0; k < (int)particles.size(); ++k) {
-		particles[k]->tare();
+	// Greedy coloring: each spring takes the lowest color not yet used by
+	// another spring on either of its particles. Springs of one color then
+	// touch disjoint particles and can be processed concurrently.
+	// The colors used around each particle are a bit set of `words` 64-bit
+	// words, widened when a high-valence particle runs out of them.
+	int nVerts = (int)pos.cols();
+	int words = 1;
+	vector<uint64_t> used(nVerts, 0);
+	vector<int> colors(springs.size());
+	int nColors = 0;
+	for(int i = 0; i < (int)springs.size(); ++i) {
+		int i0 = springs[i].i0;
+		int i1 = springs[i].i1;
+		int color = -1;
+		for(int w = 0; w < words && color < 0; ++w) {
+			uint64_t free = ~(used[i0*words+w] | used[i1*words+w]);
+			if(free) {
+				int b = 0;
+				while(!(free & (uint64_t(1) << b))) {
+					++b;
+				}
+				color = 64*w + b;
+			}
+		}
+		if(color < 0) {
+			vector<uint64_t> wider(2*(size_t)nVerts*words, 0);
+			for(int k = 0; k < nVerts; ++k) {
+				copy_n(&used[k*words], words, &wider[2*k*words]);
+			}
+			used.swap(wider);
+			color = 64*words;
+			words *= 2;
+		}
+		colors[i] = color;
+		used[i0*words + color/64] |= uint64_t(1) << (color%64);
+		used[i1*words + color/64] |= uint64_t(1) << (color%64);
+		nColors = max(nColors, color + 1);
+	}
+	
+	// Stable counting sort of the springs by color
+	colorStart.assign(nColors + 1, 0);
+	for(int color : colors) {
+		++colorStart[color + 1];
 	}
+	for(int c = 0; c < nColors; ++c) {
+		colorStart[c + 1] += colorStart[c];
+	}
+	vector<int> next(colorStart.begin(), colorStart.end() - 1);
+	vector<Spring> sorted(springs);
+	for(int i = 0; i < (int)springs.size(); ++i) {
+		sorted[next[colors[i]]++] = springs[i];
+	}
+	springs.swap(sorted);
+}
+
+// Returns the index into the value array of entry (row, col) of a compressed
+// row-major matrix.
+static int findEntry(const SparseMatrix<double, RowMajor> &A, int row, int col)
+{
+	const int *begin = A.innerIndexPtr() + A.outerIndexPtr()[row];
+	const int *end = A.innerIndexPtr() + A.outerIndexPtr()[row+1];
+	const int *it = lower_bound(begin, end, col);
+	assert(it != end && *it == col);
+	return (int)(it - A.innerIndexPtr());
+}
+
+// Adds a 3x3 block into the value array, given the value index of each of its rows.
+static inline void addBlock(double *values, const int *idx, const Matrix3d &B)
+{
+	for(int j = 0; j < 3; ++j) {
+		double *row = values + idx[j];
+		row[0] += B(j,0);
+		row[1] += B(j,1);
+		row[2] += B(j,2);
+	}
+}
+
+void Cloth::buildPattern()
+{
+	// Symbolic pass: one diagonal block per free particle (mass, spring, and
+	// contact terms) and a pair of off-diagonal blocks per free-free spring.
+	int nVerts = (int)pos.cols();
+	vector<Triplet<double>> trips;
+	for(int k = 0; k < nVerts; ++k) {
+		if(!fixed[k]) {
+			for(int j = 0; j < 3; ++j) {
+				for(int i = 0; i < 3; ++i) {
+					trips.push_back(Triplet<double>(dofs[k] + j, dofs[k] + i, 0.0));
+				}
+			}
+		}
+	}
+	for(const Spring &s : springs) {
+		if(!fixed[s.i0] && !fixed[s.i1]) {
+			for(int j = 0; j < 3; ++j) {
+				for(int i = 0; i < 3; ++i) {
+					trips.push_back(Triplet<double>(dofs[s.i0] + j, dofs[s.i1] + i, 0.0));
+					trips.push_back(Triplet<double>(dofs[s.i1] + j, dofs[s.i0] + i, 0.0));
+				}
+			}
+		}
+	}
+	A.resize(n, n);
+	A.setFromTriplets(trips.begin(), trips.end());
+	A.makeCompressed();
+	Af = A.cast<float>();
+	if(rows > 0) {
+		multigrid = make_shared< MultigridPreconditioner<double> >();
+		multigrid->setGrid(rows, cols, dofs);
+		multigrid->setNumThreads(nThreads);
+		multigridF = make_shared< MultigridPreconditioner<float> >();
+		multigridF->setGrid(rows, cols, dofs);
+		multigridF->setNumThreads(nThreads);
+	}
+	
+	// Cache where each block lives in the value array
+	diagBlockIdx.assign(3*nVerts, -1);
+	for(int k = 0; k < nVerts; ++k) {
+		if(!fixed[k]) {
+			for(int j = 0; j < 3; ++j) {
+				diagBlockIdx[3*k+j] = findEntry(A, dofs[k] + j, dofs[k]);
+			}
+		}
+	}
+	springBlockIdx.assign(6*springs.size(), -1);
+	for(int s = 0; s < (int)springs.size(); ++s) {
+		int d0 = dofs[springs[s].i0];
+		int d1 = dofs[springs[s].i1];
+		if(d0 >= 0 && d1 >= 0) {
+			for(int j = 0; j < 3; ++j) {
+				springBlockIdx[6*s+j] = findEntry(A, d0 + j, d1);
+				springBlockIdx[6*s+3+j] = findEntry(A, d1 + j, d0);
+			}
+		}
+	}
+}
+
+void Cloth::tare()
+{
+	pos0 = pos;
+	vel0 = vel;
 }
 
 void Cloth::reset()
 {
-	for(int k = 0; k < (int)particles.size(); ++k) {
-		particles[k]->reset();
+	pos = pos0;
+	vel = vel0;
+	updatePosNor();
+}
+
+void Cloth::initBuffers()
+{
+	assert(uploader);
+	frames->update();
+	const Frame &frame = frames->getFront();
+	uploader->init(getNumParticles(), eleBuf, rows == 0 ? BufferUploader::TRIANGLES : BufferUploader::TRIANGLE_STRIP);
+	uploader->upload(&frame.posBuf[0], &frame.norBuf[0]);
+}
+
+void Cloth::uploadFrame() const
+{
+	// Only upload when the simulator has published a new frame, and ask for
+	// the next one
+	if(frames->update()) {
+		const Frame &frame = frames->getFront();
+		uploader->upload(&frame.posBuf[0], &frame.norBuf[0]);
 	}
+	frames->request();
+}
+
+void Cloth::setPositions(const Matrix3Xd &x)
+{
+	assert(x.cols() == pos.cols());
+	pos = x;
+	vel.setZero();
 	updatePosNor();
 }
 
+// Checkpoint file: a header, a table of sections, then the sections. Each
+// section is one raw array starting on a 64-byte boundary, so that it can be
+// read straight out of a mapping of the file.
+static const uint32_t CHECKPOINT_VERSION = 1;
+static const size_t CHECKPOINT_ALIGN = 64;
+
+enum CheckpointSectionId
+{
+	CHECKPOINT_POS,
+	CHECKPOINT_VEL,
+	CHECKPOINT_POS0,
+	CHECKPOINT_VEL0,
+	CHECKPOINT_MASS,
+	CHECKPOINT_FIXED,
+	CHECKPOINT_DOFS,
+	CHECKPOINT_SPRINGS,     // in color order, with rest lengths and stiffnesses
+	CHECKPOINT_COLOR_START,
+	CHECKPOINT_WARM_START,  // solver velocity v
+	CHECKPOINT_TEX,
+	CHECKPOINT_ELEMENTS,
+	CHECKPOINT_TRIS,
+	CHECKPOINT_VERT_TRI_START,
+	CHECKPOINT_VERT_TRIS,
+	CHECKPOINT_SECTIONS
+};
+
+struct CheckpointHeader
+{
+	char magic[4]; // "A5CK"
+	uint32_t version;
+	uint32_t nSections;
+	int32_t rows;
+	int32_t cols;
+	int32_t n;
+	int32_t nVerts;
+	int32_t integrator;
+	int32_t solver;
+	int32_t precond;
+	int32_t precision;
+	int32_t iterMax;
+	int32_t pdIterations;
+	int32_t matrixFree;
+	int32_t selfCollision;
+	int32_t ccd;
+	double r;
+	double tol;
+	double selfThickness;
+	double selfStiffness;
+};
+
+struct CheckpointSection
+{
+	uint32_t id;
+	uint32_t reserved;
+	uint64_t offset;
+	uint64_t bytes;
+};
+
+static size_t alignCheckpoint(size_t offset)
+{
+	return (offset + CHECKPOINT_ALIGN - 1)/CHECKPOINT_ALIGN*CHECKPOINT_ALIGN;
+}
+
+bool Cloth::saveCheckpoint(const string &filename) const
+{
+	PROFILE_SCOPE("Cloth::saveCheckpoint");
+	static_assert(sizeof(Spring) == 2*sizeof(int) + 2*sizeof(double), "springs are stored as raw records");
+	static_assert(sizeof(Vector3i) == 3*sizeof(int), "triangles are stored as raw records");
+	struct Array
+	{
+		const void *data;
+		size_t bytes;
+	};
+	const Array arrays[CHECKPOINT_SECTIONS] = {
+		{pos.data(), pos.size()*sizeof(double)},
+		{vel.data(), vel.size()*sizeof(double)},
+		{pos0.data(), pos0.size()*sizeof(double)},
+		{vel0.data(), vel0.size()*sizeof(double)},
+		{m.data(), m.size()*sizeof(double)},
+		{fixed.data(), fixed.size()*sizeof(char)},
+		{dofs.data(), dofs.size()*sizeof(int)},
+		{springs.data(), springs.size()*sizeof(Spring)},
+		{colorStart.data(), colorStart.size()*sizeof(int)},
+		{v.data(), v.size()*sizeof(double)},
+		{texBuf.data(), texBuf.size()*sizeof(float)},
+		{eleBuf.data(), eleBuf.size()*sizeof(unsigned int)},
+		{tris.data(), tris.size()*sizeof(Vector3i)},
+		{vertTriStart.data(), vertTriStart.size()*sizeof(int)},
+		{vertTris.data(), vertTris.size()*sizeof(int)}
+	};
+	
+	CheckpointHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, "A5CK", 4);
+	header.version = CHECKPOINT_VERSION;
+	header.nSections = CHECKPOINT_SECTIONS;
+	header.rows = rows;
+	header.cols = cols;
+	header.n = n;
+	header.nVerts = (int32_t)pos.cols();
+	header.integrator = integrator;
+	header.solver = solver;
+	header.precond = precond;
+	header.precision = precision;
+	header.iterMax = iterMax;
+	header.pdIterations = pdIterations;
+	header.matrixFree = matrixFree;
+	header.selfCollision = selfCollision;
+	header.ccd = ccd;
+	header.r = r;
+	header.tol = tol;
+	header.selfThickness = selfThickness;
+	header.selfStiffness = selfStiffness;
+	
+	CheckpointSection table[CHECKPOINT_SECTIONS];
+	size_t offset = alignCheckpoint(sizeof(header) + sizeof(table));
+	for(int k = 0; k < CHECKPOINT_SECTIONS; ++k) {
+		table[k].id = k;
+		table[k].reserved = 0;
+		table[k].offset = offset;
+		table[k].bytes = arrays[k].bytes;
+		offset = alignCheckpoint(offset + arrays[k].bytes);
+	}
+	
+	// Write to a temporary file and rename it, so that a run killed while
+	// writing leaves the previous checkpoint intact
+	string tmpName = filename + ".tmp";
+	ofstream out(tmpName, ios::binary | ios::trunc);
+	if(!out.good()) {
+		cerr << "Cannot write to " << tmpName << endl;
+		return false;
+	}
+	out.write((const char *)&header, sizeof(header));
+	out.write((const char *)table, sizeof(table));
+	const char zeros[CHECKPOINT_ALIGN] = {};
+	size_t written = sizeof(header) + sizeof(table);
+	for(int k = 0; k < CHECKPOINT_SECTIONS; ++k) {
+		out.write(zeros, table[k].offset - written);
+		out.write((const char *)arrays[k].data, arrays[k].bytes);
+		written = table[k].offset + arrays[k].bytes;
+	}
+	out.close();
+	if(!out.good()) {
+		cerr << "Cannot write to " << tmpName << endl;
+		return false;
+	}
+#ifdef _WIN32
+	remove(filename.c_str());
+#endif
+	if(rename(tmpName.c_str(), filename.c_str()) != 0) {
+		cerr << "Cannot rename " << tmpName << " to " << filename << endl;
+		return false;
+	}
+	return true;
+}
+
+shared_ptr<Cloth> Cloth::loadCheckpoint(const string &filename)
+{
+	PROFILE_SCOPE("Cloth::loadCheckpoint");
+	MappedFile file;
+	if(!file.open(filename)) {
+		return nullptr;
+	}
+	const char *data = file.getData();
+	size_t size = file.getSize();
+	CheckpointHeader header;
+	bool valid = size >= sizeof(header);
+	if(valid) {
+		memcpy(&header, data, sizeof(header));
+		valid = memcmp(header.magic, "A5CK", 4) == 0 && header.version == CHECKPOINT_VERSION;
+		valid = valid && header.nSections >= CHECKPOINT_SECTIONS && sizeof(header) + header.nSections*sizeof(CheckpointSection) <= size;
+		valid = valid && header.nVerts > 0 && header.n >= 0 && header.n <= 3*header.nVerts;
+	}
+	if(!valid) {
+		cerr << filename << " is not a valid checkpoint" << endl;
+		return nullptr;
+	}
+	
+	// Sections are found by id, so later versions can add new ones
+	const CheckpointSection *table = (const CheckpointSection *)(data + sizeof(header));
+	const char *sections[CHECKPOINT_SECTIONS] = {};
+	size_t counts[CHECKPOINT_SECTIONS] = {};
+	const size_t itemBytes[CHECKPOINT_SECTIONS] = {
+		3*sizeof(double), 3*sizeof(double), 3*sizeof(double), 3*sizeof(double), sizeof(double),
+		sizeof(char), sizeof(int), sizeof(Spring), sizeof(int), sizeof(double), 2*sizeof(float),
+		sizeof(unsigned int), sizeof(Vector3i), sizeof(int), sizeof(int)
+	};
+	for(uint32_t k = 0; k < header.nSections; ++k) {
+		const CheckpointSection &s = table[k];
+		if(s.id < CHECKPOINT_SECTIONS && s.offset <= size && s.bytes <= size - s.offset && s.bytes % itemBytes[s.id] == 0) {
+			sections[s.id] = data + s.offset;
+			counts[s.id] = s.bytes/itemBytes[s.id];
+		}
+	}
+	size_t nVerts = header.nVerts;
+	for(int k = CHECKPOINT_POS; k <= CHECKPOINT_DOFS; ++k) {
+		valid = valid && sections[k] && counts[k] == nVerts;
+	}
+	valid = valid && sections[CHECKPOINT_SPRINGS] && counts[CHECKPOINT_SPRINGS] > 0;
+	valid = valid && sections[CHECKPOINT_COLOR_START] && counts[CHECKPOINT_COLOR_START] > 0;
+	valid = valid && sections[CHECKPOINT_WARM_START] && counts[CHECKPOINT_WARM_START] == (size_t)header.n;
+	valid = valid && sections[CHECKPOINT_TEX] && counts[CHECKPOINT_TEX] == nVerts;
+	for(int k = CHECKPOINT_ELEMENTS; k < CHECKPOINT_SECTIONS; ++k) {
+		valid = valid && sections[k];
+	}
+	if(!valid) {
+		cerr << filename << " is missing sections or is truncated" << endl;
+		return nullptr;
+	}
+	
+	// Check every index against the array it points into, and every enum
+	// against its range, before anything is built from them
+	const int *dofs = (const int *)sections[CHECKPOINT_DOFS];
+	const char *fixed = sections[CHECKPOINT_FIXED];
+	const Spring *springs = (const Spring *)sections[CHECKPOINT_SPRINGS];
+	size_t nSprings = counts[CHECKPOINT_SPRINGS];
+	const int *colorStart = (const int *)sections[CHECKPOINT_COLOR_START];
+	size_t nColors = counts[CHECKPOINT_COLOR_START] - 1;
+	const unsigned int *elements = (const unsigned int *)sections[CHECKPOINT_ELEMENTS];
+	const Vector3i *tris = (const Vector3i *)sections[CHECKPOINT_TRIS];
+	size_t nTris = counts[CHECKPOINT_TRIS];
+	const int *vertTriStart = (const int *)sections[CHECKPOINT_VERT_TRI_START];
+	const int *vertTris = (const int *)sections[CHECKPOINT_VERT_TRIS];
+	size_t nVertTris = counts[CHECKPOINT_VERT_TRIS];
+	valid = header.integrator >= IMPLICIT_EULER && header.integrator <= PROJECTIVE_DYNAMICS;
+	valid = valid && header.solver >= CONJUGATE_GRADIENT && header.solver <= DIRECT;
+	valid = valid && header.precond >= NO_PRECONDITIONER && header.precond <= MULTIGRID;
+	valid = valid && header.precision >= DOUBLE_PRECISION && header.precision <= MIXED_PRECISION;
+	valid = valid && colorStart[0] == 0 && colorStart[nColors] == (int)nSprings;
+	for(size_t c = 0; c < nColors; ++c) {
+		valid = valid && colorStart[c] <= colorStart[c+1];
+	}
+	for(size_t k = 0; k < nSprings; ++k) {
+		const Spring &s = springs[k];
+		valid = valid && s.i0 >= 0 && s.i0 < (int)nVerts && s.i1 >= 0 && s.i1 < (int)nVerts;
+	}
+	for(size_t k = 0; k < nVerts; ++k) {
+		valid = valid && (fixed[k] ? dofs[k] == -1 : dofs[k] >= 0 && dofs[k] % 3 == 0 && dofs[k] + 2 < header.n);
+	}
+	for(size_t k = 0; k < counts[CHECKPOINT_ELEMENTS]; ++k) {
+		valid = valid && (elements[k] == BufferUploader::RESTART_INDEX || elements[k] < nVerts);
+	}
+	for(size_t k = 0; k < nTris; ++k) {
+		valid = valid && tris[k].minCoeff() >= 0 && tris[k].maxCoeff() < (int)nVerts;
+	}
+	for(size_t k = 0; k < nVertTris; ++k) {
+		valid = valid && vertTris[k] >= 0 && vertTris[k] < (int)nTris;
+	}
+	if(header.rows == 0) {
+		// Mesh: the triangles around vertex k are vertTris[vertTriStart[k]..vertTriStart[k+1])
+		valid = valid && header.cols == 0 && nTris > 0;
+		valid = valid && counts[CHECKPOINT_VERT_TRI_START] == nVerts + 1 && vertTriStart[0] == 0 && vertTriStart[nVerts] == (int)nVertTris;
+		for(size_t k = 0; valid && k < nVerts; ++k) {
+			valid = vertTriStart[k] <= vertTriStart[k+1];
+		}
+	} else {
+		valid = valid && header.rows > 0 && header.cols > 0 && (int64_t)header.rows*header.cols == header.nVerts;
+	}
+	if(!valid) {
+		cerr << filename << " has inconsistent indices" << endl;
+		return nullptr;
+	}
+	
+	shared_ptr<Cloth> cloth(new Cloth());
+	cloth->rows = header.rows;
+	cloth->cols = header.cols;
+	cloth->setDefaults((Integrator)header.integrator);
+	cloth->n = header.n;
+	cloth->r = header.r;
+	cloth->pos = Map<const Matrix3Xd>((const double *)sections[CHECKPOINT_POS], 3, nVerts);
+	cloth->vel = Map<const Matrix3Xd>((const double *)sections[CHECKPOINT_VEL], 3, nVerts);
+	cloth->pos0 = Map<const Matrix3Xd>((const double *)sections[CHECKPOINT_POS0], 3, nVerts);
+	cloth->vel0 = Map<const Matrix3Xd>((const double *)sections[CHECKPOINT_VEL0], 3, nVerts);
+	cloth->m = Map<const VectorXd>((const double *)sections[CHECKPOINT_MASS], nVerts);
+	cloth->fixed.assign(fixed, fixed + nVerts);
+	cloth->dofs.assign(dofs, dofs + nVerts);
+	cloth->springs.assign(springs, springs + nSprings);
+	cloth->colorStart.assign(colorStart, colorStart + nColors + 1);
+	const float *tex = (const float *)sections[CHECKPOINT_TEX];
+	cloth->texBuf.assign(tex, tex + 2*nVerts);
+	cloth->eleBuf.assign(elements, elements + counts[CHECKPOINT_ELEMENTS]);
+	cloth->tris.assign(tris, tris + nTris);
+	cloth->vertTriStart.assign(vertTriStart, vertTriStart + counts[CHECKPOINT_VERT_TRI_START]);
+	cloth->vertTris.assign(vertTris, vertTris + nVertTris);
+	if(cloth->rows == 0) {
+		cloth->triNor.resize(3, nTris);
+	}
+	
+	cloth->setup(header.selfStiffness);
+	cloth->v = Map<const VectorXd>((const double *)sections[CHECKPOINT_WARM_START], header.n);
+	cloth->selfThickness = header.selfThickness;
+	cloth->pdIterations = header.pdIterations;
+	cloth->solver = (Solver)header.solver;
+	cloth->precond = (Preconditioner)header.precond;
+	cloth->precision = (Precision)header.precision;
+	cloth->iterMax = header.iterMax;
+	cloth->tol = header.tol;
+	cloth->ccd = header.ccd != 0;
+	cloth->setMatrixFree(header.matrixFree != 0);
+	cloth->setSelfCollision(header.selfCollision != 0);
+	return cloth;
+}
+
+// Normal of particle (i,j), averaged over its (up to) four neighboring triangles
+static Vector3d vertexNormal(const Matrix3Xd &pos, int rows, int cols, int i, int j)
+{
+	// Each particle has four neighbors
+	//
+	//      v1
+	//     /|\
+	// u0 /_|_\ u1
+	//    \ | /
+	//     \|/
+	//      v0
+	//
+	// Use these four triangles to compute the normal
+	int k = i*cols + j;
+	int ku0 = k - 1;
+	int ku1 = k + 1;
+	int kv0 = k - cols;
+	int kv1 = k + cols;
+	Vector3d x = pos.col(k);
+	Vector3d xu1, xv1, dx0, dx1, c;
+	Vector3d nor(0.0, 0.0, 0.0);
+	int count = 0;
+	// Top-right triangle
+	if(j != cols-1 && i != rows-1) {
+		xu1 = pos.col(ku1);
+		xv1 = pos.col(kv1);
+		dx0 = xu1 - x;
+		dx1 = xv1 - x;
+		c = dx0.cross(dx1);
+		nor += c.normalized();
+		++count;
+	}
+	// Top-left triangle
+	if(j != 0 && i != rows-1) {
+		xu1 = pos.col(kv1);
+		xv1 = pos.col(ku0);
+		dx0 = xu1 - x;
+		dx1 = xv1 - x;
+		c = dx0.cross(dx1);
+		nor += c.normalized();
+		++count;
+	}
+	// Bottom-left triangle
+	if(j != 0 && i != 0) {
+		xu1 = pos.col(ku0);
+		xv1 = pos.col(kv0);
+		dx0 = xu1 - x;
+		dx1 = xv1 - x;
+		c = dx0.cross(dx1);
+		nor += c.normalized();
+		++count;
+	}
+	// Bottom-right triangle
+	if(j != cols-1 && i != 0) {
+		xu1 = pos.col(kv0);
+		xv1 = pos.col(ku1);
+		dx0 = xu1 - x;
+		dx1 = xv1 - x;
+		c = dx0.cross(dx1);
+		nor += c.normalized();
+		++count;
+	}
+	nor /= count;
+	nor.normalize();
+	return nor;
+}
+
+// Adds the normalized cross product of edges (ax,ay,az) and (bx,by,bz) to n
+static inline void addTriangleNormal(double ax, double ay, double az, double bx, double by, double bz,
+									 double &nx, double &ny, double &nz)
+{
+	double cx = ay*bz - az*by;
+	double cy = az*bx - ax*bz;
+	double cz = ax*by - ay*bx;
+	double l = sqrt(cx*cx + cy*cy + cz*cz);
+	nx += cx/l;
+	ny += cy/l;
+	nz += cz/l;
+}
+
+#ifdef __AVX2__
+static inline void addTriangleNormal(__m256d ax, __m256d ay, __m256d az, __m256d bx, __m256d by, __m256d bz,
+									 __m256d &nx, __m256d &ny, __m256d &nz)
+{
+	__m256d cx = _mm256_sub_pd(_mm256_mul_pd(ay, bz), _mm256_mul_pd(az, by));
+	__m256d cy = _mm256_sub_pd(_mm256_mul_pd(az, bx), _mm256_mul_pd(ax, bz));
+	__m256d cz = _mm256_sub_pd(_mm256_mul_pd(ax, by), _mm256_mul_pd(ay, bx));
+	__m256d l2 = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(cx, cx), _mm256_mul_pd(cy, cy)), _mm256_mul_pd(cz, cz));
+	__m256d l = _mm256_sqrt_pd(l2);
+	nx = _mm256_add_pd(nx, _mm256_div_pd(cx, l));
+	ny = _mm256_add_pd(ny, _mm256_div_pd(cy, l));
+	nz = _mm256_add_pd(nz, _mm256_div_pd(cz, l));
+}
+#endif
+
+// Normals of the interior particles j = 1..cols-2 of one interior row, from
+// positions stored as separate x, y, z arrays. Same triangles and summation
+// order as vertexNormal, four particles at a time when AVX2 is available.
+static void interiorRowNormals(const double *X, const double *Y, const double *Z, int row, int cols, float *nor)
+{
+	int j = 1;
+#ifdef __AVX2__
+	for(; j + 4 <= cols - 1; j += 4) {
+		int k = row*cols + j;
+		__m256d x = _mm256_loadu_pd(X + k);
+		__m256d y = _mm256_loadu_pd(Y + k);
+		__m256d z = _mm256_loadu_pd(Z + k);
+		// Edges to the four neighbors
+		__m256d u1x = _mm256_sub_pd(_mm256_loadu_pd(X + k + 1), x);
+		__m256d u1y = _mm256_sub_pd(_mm256_loadu_pd(Y + k + 1), y);
+		__m256d u1z = _mm256_sub_pd(_mm256_loadu_pd(Z + k + 1), z);
+		__m256d u0x = _mm256_sub_pd(_mm256_loadu_pd(X + k - 1), x);
+		__m256d u0y = _mm256_sub_pd(_mm256_loadu_pd(Y + k - 1), y);
+		__m256d u0z = _mm256_sub_pd(_mm256_loadu_pd(Z + k - 1), z);
+		__m256d v1x = _mm256_sub_pd(_mm256_loadu_pd(X + k + cols), x);
+		__m256d v1y = _mm256_sub_pd(_mm256_loadu_pd(Y + k + cols), y);
+		__m256d v1z = _mm256_sub_pd(_mm256_loadu_pd(Z + k + cols), z);
+		__m256d v0x = _mm256_sub_pd(_mm256_loadu_pd(X + k - cols), x);
+		__m256d v0y = _mm256_sub_pd(_mm256_loadu_pd(Y + k - cols), y);
+		__m256d v0z = _mm256_sub_pd(_mm256_loadu_pd(Z + k - cols), z);
+		__m256d nx = _mm256_setzero_pd();
+		__m256d ny = _mm256_setzero_pd();
+		__m256d nz = _mm256_setzero_pd();
+		addTriangleNormal(u1x, u1y, u1z, v1x, v1y, v1z, nx, ny, nz);
+		addTriangleNormal(v1x, v1y, v1z, u0x, u0y, u0z, nx, ny, nz);
+		addTriangleNormal(u0x, u0y, u0z, v0x, v0y, v0z, nx, ny, nz);
+		addTriangleNormal(v0x, v0y, v0z, u1x, u1y, u1z, nx, ny, nz);
+		__m256d quarter = _mm256_set1_pd(0.25);
+		nx = _mm256_mul_pd(nx, quarter);
+		ny = _mm256_mul_pd(ny, quarter);
+		nz = _mm256_mul_pd(nz, quarter);
+		__m256d l2 = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(nx, nx), _mm256_mul_pd(ny, ny)), _mm256_mul_pd(nz, nz));
+		__m256d l = _mm256_sqrt_pd(l2);
+		double bx[4], by[4], bz[4];
+		_mm256_storeu_pd(bx, _mm256_div_pd(nx, l));
+		_mm256_storeu_pd(by, _mm256_div_pd(ny, l));
+		_mm256_storeu_pd(bz, _mm256_div_pd(nz, l));
+		for(int q = 0; q < 4; ++q) {
+			nor[3*(k+q)+0] = (float)bx[q];
+			nor[3*(k+q)+1] = (float)by[q];
+			nor[3*(k+q)+2] = (float)bz[q];
+		}
+	}
+#endif
+	for(; j < cols - 1; ++j) {
+		int k = row*cols + j;
+		double x = X[k], y = Y[k], z = Z[k];
+		double u1x = X[k+1] - x, u1y = Y[k+1] - y, u1z = Z[k+1] - z;
+		double u0x = X[k-1] - x, u0y = Y[k-1] - y, u0z = Z[k-1] - z;
+		double v1x = X[k+cols] - x, v1y = Y[k+cols] - y, v1z = Z[k+cols] - z;
+		double v0x = X[k-cols] - x, v0y = Y[k-cols] - y, v0z = Z[k-cols] - z;
+		double nx = 0.0, ny = 0.0, nz = 0.0;
+		addTriangleNormal(u1x, u1y, u1z, v1x, v1y, v1z, nx, ny, nz);
+		addTriangleNormal(v1x, v1y, v1z, u0x, u0y, u0z, nx, ny, nz);
+		addTriangleNormal(u0x, u0y, u0z, v0x, v0y, v0z, nx, ny, nz);
+		addTriangleNormal(v0x, v0y, v0z, u1x, u1y, u1z, nx, ny, nz);
+		nx *= 0.25;
+		ny *= 0.25;
+		nz *= 0.25;
+		double l = sqrt(nx*nx + ny*ny + nz*nz);
+		nor[3*k+0] = (float)(nx/l);
+		nor[3*k+1] = (float)(ny/l);
+		nor[3*k+2] = (float)(nz/l);
+	}
+}
+
 void Cloth::updatePosNor()
 {
+	PROFILE_SCOPE("Cloth::updatePosNor");
+	Frame &frame = frames->getBack();
+	vector<float> &posBuf = frame.posBuf;
+	vector<float> &norBuf = frame.norBuf;
+	int nVerts = (int)pos.cols();
+	
 	// Position
-	for(int i = 0; i < rows; ++i) {
-		for(int j = 0; j < cols; ++j) {
-			int k = i*cols + j;
-			Vector3d x = particles[k]->x;
-			posBuf[3*k+0] = x(0);
-			posBuf[3*k+1] = x(1);
-			posBuf[3*k+2] = x(2);
+	const double *x = pos.data();
+	for(int k = 0; k < 3*nVerts; ++k) {
+		posBuf[k] = (float)x[k];
+	}
+	
+	if(rows == 0) {
+		// Mesh: area-weighted triangle normals, then gathered per vertex so
+		// that no two threads write to the same normal
+		#pragma omp parallel num_threads(nThreads)
+		{
+			#pragma omp for
+			for(int t = 0; t < (int)tris.size(); ++t) {
+				const Vector3i &tri = tris[t];
+				triNor.col(t) = (pos.col(tri(1)) - pos.col(tri(0))).cross(pos.col(tri(2)) - pos.col(tri(0)));
+			}
+			#pragma omp for
+			for(int k = 0; k < nVerts; ++k) {
+				Vector3d nor = Vector3d::Zero();
+				for(int a = vertTriStart[k]; a < vertTriStart[k+1]; ++a) {
+					nor += triNor.col(vertTris[a]);
+				}
+				nor.normalize();
+				norBuf[3*k+0] = nor(0);
+				norBuf[3*k+1] = nor(1);
+				norBuf[3*k+2] = nor(2);
+			}
 		}
+		frames->publish();
+		return;
 	}
 	
-	// Normal
+	// Normal: the boundary one particle at a time, the interior a row at a
+	// time over contiguous x, y, z arrays
+	posSoA = pos.transpose();
+	#pragma omp parallel for num_threads(nThreads)
 	for(int i = 0; i < rows; ++i) {
-		for(int j = 0; j < cols; ++j) {
-			// Each particle has four neighbors
-			//
-			//      v1
-			//     /|\
-			// u0 /_|_\ u1
-			//    \ | /
-			//     \|/
-			//      v0
-			//
-			// Use these four triangles to compute the normal
-			int k = i*cols + j;
-			int ku0 = k - 1;
-			int ku1 = k + 1;
-			int kv0 = k - cols;
-			int kv1 = k + cols;
-			Vector3d x = particles[k]->x;
-			Vector3d xu0, xu1, xv0, xv1, dx0, dx1, c;
-			Vector3d nor(0.0, 0.0, 0.0);
-			int count = 0;
-			// Top-right triangle
-			if(j != cols-1 && i != rows-1) {
-				xu1 = particles[ku1]->x;
-				xv1 = particles[kv1]->x;
-				dx0 = xu1 - x;
-				dx1 = xv1 - x;
-				c = dx0.cross(dx1);
-				nor += c.normalized();
-				++count;
-			}
-			// Top-left triangle
-			if(j != 0 && i != rows-1) {
-				xu1 = particles[kv1]->x;
-				xv1 = particles[ku0]->x;
-				dx0 = xu1 - x;
-				dx1 = xv1 - x;
-				c = dx0.cross(dx1);
-				nor += c.normalized();
-				++count;
-			}
-			// Bottom-left triangle
-			if(j != 0 && i != 0) {
-				xu1 = particles[ku0]->x;
-				xv1 = particles[kv0]->x;
-				dx0 = xu1 - x;
-				dx1 = xv1 - x;
-				c = dx0.cross(dx1);
-				nor += c.normalized();
-				++count;
-			}
-			// Bottom-right triangle
-			if(j != cols-1 && i != 0) {
-				xu1 = particles[kv0]->x;
-				xv1 = particles[ku1]->x;
-				dx0 = xu1 - x;
-				dx1 = xv1 - x;
-				c = dx0.cross(dx1);
-				nor += c.normalized();
-				++count;
-			}
-			nor /= count;
-			nor.normalize();
-			norBuf[3*k+0] = nor(0);
-			norBuf[3*k+1] = nor(1);
-			norBuf[3*k+2] = nor(2);
-		}
-	}
-}
-
-void Cloth::step(double h, const Vector3d &grav, const vector< shared_ptr<Particle> > spheres)
-{
-	// collision stiffness
-	const double c = 1e1;
+		if(i == 0 || i == rows-1) {
+			for(int j = 0; j < cols; ++j) {
+				Vector3d nor = vertexNormal(pos, rows, cols, i, j);
+				int k = i*cols + j;
+				norBuf[3*k+0] = nor(0);
+				norBuf[3*k+1] = nor(1);
+				norBuf[3*k+2] = nor(2);
+			}
+		} else {
+			for(int j = 0; j < cols; j += cols-1) {
+				Vector3d nor = vertexNormal(pos, rows, cols, i, j);
+				int k = i*cols + j;
+				norBuf[3*k+0] = nor(0);
+				norBuf[3*k+1] = nor(1);
+				norBuf[3*k+2] = nor(2);
+			}
+			interiorRowNormals(posSoA.col(0).data(), posSoA.col(1).data(), posSoA.col(2).data(), i, cols, &norBuf[0]);
+		}
+	}
 	
-	// store previous velocity to help solve later
-	VectorXd pv = v;
-	v.setZero();
-	f.setZero();
+	// Hand the completed frame to the renderer
+	frames->publish();
+}
+
+// Runs preconditioned CG on A x = b starting from guess. precond carries any
+// setup the preconditioner needs before compute().
+template<typename MatType, typename Precond, typename Vector>
+static Vector solveCG(const MatType &A, const Vector &b, const Vector &guess, int iterMax, double tol, int &iter, double &err, Cloth::Timings &timings,
+					  const Precond &precond = Precond())
+{
+	Clock::time_point t = Clock::now();
+	ConjugateGradient< MatType, Lower|Upper, Precond > cg;
+	cg.preconditioner() = precond;
+	cg.setMaxIterations(iterMax);
+	cg.setTolerance(tol);
+	cg.compute(A);
+	timings.compute += lap(t);
+	Vector x = cg.solveWithGuess(b, guess);
+	timings.solve += lap(t);
+	iter = (int)cg.iterations();
+	err = cg.error();
+	return x;
+}
+
+// Preconditioned CG on the assembled system, in the precision of A
+template<typename Scalar, typename ICSolverType>
+static Matrix<Scalar, Dynamic, 1> solveAssembled(const SparseMatrix<Scalar, RowMajor> &A,
+												 const Matrix<Scalar, Dynamic, 1> &b,
+												 const Matrix<Scalar, Dynamic, 1> &guess,
+												 Cloth::Preconditioner precond,
+												 shared_ptr<ICSolverType> &icSolver,
+												 const shared_ptr< MultigridPreconditioner<Scalar> > &multigrid,
+												 int iterMax, double tol, int &iter, double &err,
+												 Cloth::Timings &timings)
+{
+	typedef SparseMatrix<Scalar, RowMajor> MatType;
+	if(precond == Cloth::MULTIGRID && !multigrid) {
+		// Not a grid
+		precond = Cloth::BLOCK_JACOBI;
+	}
+	switch(precond) {
+		case Cloth::MULTIGRID:
+			return solveCG< MatType, MultigridPreconditioner<Scalar> >(A, b, guess, iterMax, tol, iter, err, timings, *multigrid);
+		case Cloth::NO_PRECONDITIONER:
+			return solveCG< MatType, IdentityPreconditioner >(A, b, guess, iterMax, tol, iter, err, timings);
+		case Cloth::JACOBI:
+			return solveCG< MatType, DiagonalPreconditioner<Scalar> >(A, b, guess, iterMax, tol, iter, err, timings);
+		case Cloth::BLOCK_JACOBI:
+			return solveCG< MatType, BlockJacobiPreconditioner<3, Scalar> >(A, b, guess, iterMax, tol, iter, err, timings);
+		case Cloth::INCOMPLETE_CHOLESKY:
+		default:
+			if(!icSolver) {
+				icSolver = make_shared<ICSolverType>();
+				icSolver->analyzePattern(A);
+			}
+			Clock::time_point t = Clock::now();
+			icSolver->setMaxIterations(iterMax);
+			icSolver->setTolerance(tol);
+			icSolver->factorize(A);
+			timings.compute += lap(t);
+			Matrix<Scalar, Dynamic, 1> x = icSolver->solveWithGuess(b, guess);
+			timings.solve += lap(t);
+			iter = (int)icSolver->iterations();
+			err = icSolver->error();
+			return x;
+	}
+}
+
+// Chebyshev semi-iteration with a block-Jacobi preconditioner. If it does
+// not converge within the budget, CG finishes the solve from where it got.
+template<typename MatType>
+static VectorXd solveChebyshev(const MatType &A, const VectorXd &b, const VectorXd &guess, ChebyshevSolver &chebyshev, int iterMax, double tol, int &iter, int &estimateIter, double &err, Cloth::Timings &timings)
+{
+	Clock::time_point t = Clock::now();
+	BlockJacobiPreconditioner<3> P;
+	P.compute(A);
+	timings.compute += lap(t);
+	chebyshev.setMaxIterations(iterMax);
+	chebyshev.setTolerance(tol);
+	VectorXd x = chebyshev.solveWithGuess(A, P, b, guess);
+	timings.solve += lap(t);
+	iter = chebyshev.iterations();
+	estimateIter = chebyshev.estimateIterations();
+	err = chebyshev.error();
+	if(!chebyshev.converged()) {
+		int cgIter;
+		x = solveCG< MatType, BlockJacobiPreconditioner<3> >(A, b, x, iterMax, tol, cgIter, err, timings);
+		iter += cgIter;
+	}
+	return x;
+}
+
+void Cloth::solve(const VectorXd &b, const VectorXd &guess)
+{
+	PROFILE_SCOPE("Cloth::solve");
+	estimateIter = 0;
+	if(solver == CHEBYSHEV) {
+		if(matrixFree) {
+			v = solveChebyshev(*op, b, guess, *chebyshev, iterMax, tol, iter, estimateIter, err, timings);
+		} else {
+			v = solveChebyshev(A, b, guess, *chebyshev, iterMax, tol, iter, estimateIter, err, timings);
+		}
+		return;
+	}
 	
+	if(solver == DIRECT && !matrixFree) {
+		Clock::time_point t = Clock::now();
+		if(!ldlt) {
+			ldlt = make_shared< SimplicialLDLT< SparseMatrix<double, RowMajor>, Lower, AMDOrdering<int> > >();
+			ldlt->analyzePattern(A);
+		}
+		ldlt->factorize(A);
+		timings.compute += lap(t);
+		if(ldlt->info() == Success) {
+			v = ldlt->solve(b);
+			timings.solve += lap(t);
+			iter = 0;
+			double bnorm = b.norm();
+			err = bnorm > 0.0 ? (b - A*v).norm()/bnorm : 0.0;
+			return;
+		}
+		// Not factorizable (e.g. a zero pivot): fall through to CG
+	}
+	
+	if(matrixFree) {
+		switch(precond) {
+			case NO_PRECONDITIONER:
+				v = solveCG< ClothOperator, IdentityPreconditioner >(*op, b, guess, iterMax, tol, iter, err, timings);
+				break;
+			case JACOBI:
+				v = solveCG< ClothOperator, BlockJacobiPreconditioner<1> >(*op, b, guess, iterMax, tol, iter, err, timings);
+				break;
+			case BLOCK_JACOBI:
+			case INCOMPLETE_CHOLESKY:
+			case MULTIGRID:
+				v = solveCG< ClothOperator, BlockJacobiPreconditioner<3> >(*op, b, guess, iterMax, tol, iter, err, timings);
+				break;
+		}
+		return;
+	}
+	
+	if(precision == DOUBLE_PRECISION) {
+		v = solveAssembled<double>(A, b, guess, precond, icSolver, multigrid, iterMax, tol, iter, err, timings);
+		return;
+	}
+	
+	// Narrow the system into the float copy of the pattern
+	const double *values = A.valuePtr();
+	float *valuesf = Af.valuePtr();
+	for(int k = 0; k < (int)A.nonZeros(); ++k) {
+		valuesf[k] = (float)values[k];
+	}
+	
+	if(precision == SINGLE_PRECISION) {
+		VectorXf bf = b.cast<float>();
+		VectorXf guessf = guess.cast<float>();
+		v = solveAssembled<float>(Af, bf, guessf, precond, icSolverF, multigridF, iterMax, tol, iter, err, timings).cast<double>();
+		return;
+	}
+	
+	// Mixed: correct the double solution with float CG solves on the double
+	// residual until it converges or the iteration budget is used up
+	const int sweepMax = 4;
+	double bnorm = b.norm();
+	v = guess;
+	iter = 0;
+	for(int sweep = 0; sweep < sweepMax && iter < iterMax; ++sweep) {
+		VectorXd r = b - A*v;
+		err = bnorm > 0.0 ? r.norm()/bnorm : 0.0;
+		if(err < tol) {
+			return;
+		}
+		VectorXf rf = r.cast<float>();
+		VectorXf df = VectorXf::Zero(n);
+		int inner;
+		double innerErr;
+		// float CG cannot resolve much below 1e-4 relative to its right-hand side
+		df = solveAssembled<float>(Af, rf, df, precond, icSolverF, multigridF, iterMax - iter, max(tol/err, 1e-4), inner, innerErr, timings);
+		v += df.cast<double>();
+		iter += inner;
+	}
+	err = bnorm > 0.0 ? (b - A*v).norm()/bnorm : 0.0;
+}
+
+void Cloth::setNumThreads(int nThreads)
+{
+	assert(nThreads > 0);
+	this->nThreads = nThreads;
+	op->setNumThreads(nThreads);
+	if(multigrid) {
+		multigrid->setNumThreads(nThreads);
+		multigridF->setNumThreads(nThreads);
+	}
+}
+
+void Cloth::setSelfCollisionStiffness(double stiffness)
+{
+	selfStiffness = stiffness;
+	chebyshev->invalidate();
+}
 
-	vector<Triplet<double>> kTrips;
-	vector<Triplet<double>> mTrips;
-	for (int i = 0; i < particles.size(); i++)
+void Cloth::setSelfCollision(bool selfCollision)
+{
+	this->selfCollision = selfCollision;
+	if(!selfCollision || bvh) {
+		return;
+	}
+	int nVerts = (int)pos.cols();
+	
+	// Particles that share a spring never collide with each other's triangles
+	vector< vector<int> > nbrs(nVerts);
+	for(const Spring &s : springs) {
+		nbrs[s.i0].push_back(s.i1);
+		nbrs[s.i1].push_back(s.i0);
+	}
+	adjStart.assign(1, 0);
+	adj.clear();
+	for(int k = 0; k < nVerts; ++k) {
+		sort(nbrs[k].begin(), nbrs[k].end());
+		adj.insert(adj.end(), nbrs[k].begin(), nbrs[k].end());
+		adjStart.push_back((int)adj.size());
+	}
+	
+	bvh = make_shared<BVH>();
+	bvh->build(pos, tris);
+}
+
+void Cloth::findSelfContacts(double h2)
+{
+	PROFILE_SCOPE("Cloth::findSelfContacts");
+	int nVerts = (int)pos.cols();
+	selfForce.setZero(3, nVerts);
+	selfDiag.setZero(nVerts);
+	nSelfContacts = 0;
+	if(!selfCollision) {
+		return;
+	}
+	bvh->refit(pos, selfThickness);
+	
+	// Narrow phase: each particle against the triangles near it. Contacts are
+	// gathered per thread over contiguous particle ranges and concatenated in
+	// order, so the result does not depend on the number of threads.
+	struct Contact
 	{
-		// forces spheres have on cloth. store K matrix triplets
-		for (int j = 0; j < spheres.size(); j++)
-		{
-			Vector3d dx = particles[i]->x - spheres[j]->x;
+		int k;
+		Vector3i tri;
+		Vector3d w;
+		Vector3d nor;
+		double d;
+	};
+	vector< vector<Contact> > contacts(nThreads);
+	#pragma omp parallel num_threads(nThreads)
+	{
+		int thread = 0;
+#ifdef _OPENMP
+		thread = omp_get_thread_num();
+#endif
+		vector<Contact> &local = contacts[thread];
+		#pragma omp for schedule(static)
+		for(int k = 0; k < nVerts; ++k) {
+			Vector3d x = pos.col(k);
+			Vector3d pad = Vector3d::Constant(selfThickness);
+			const int *nbrBegin = &adj[adjStart[k]];
+			const int *nbrEnd = nbrBegin + (adjStart[k+1] - adjStart[k]);
+			bvh->query(x - pad, x + pad, [&](const Vector3i &tri) {
+				for(int i = 0; i < 3; ++i) {
+					if(tri(i) == k || binary_search(nbrBegin, nbrEnd, tri(i))) {
+						return;
+					}
+				}
+				Vector3d a = pos.col(tri(0));
+				Vector3d b = pos.col(tri(1));
+				Vector3d c = pos.col(tri(2));
+				Vector3d w = closestPointTriangle(x, a, b, c);
+				Vector3d dx = x - (w(0)*a + w(1)*b + w(2)*c);
+				double d = dx.norm();
+				if(d >= selfThickness) {
+					return;
+				}
+				Contact contact;
+				contact.k = k;
+				contact.tri = tri;
+				contact.w = w;
+				contact.nor = d > 1e-12 ? Vector3d(dx/d) : Vector3d((b - a).cross(c - a).normalized());
+				contact.d = d;
+				local.push_back(contact);
+			});
+		}
+	}
+	
+	// Penalty springs pushing the particle off the triangle. Only their
+	// diagonal stiffness goes into the system, like the sphere contacts.
+	for(const vector<Contact> &local : contacts) {
+		for(const Contact &contact : local) {
+			Vector3d fc = selfStiffness*(selfThickness - contact.d)*contact.nor;
+			selfForce.col(contact.k) += fc;
+			selfDiag(contact.k) += h2*selfStiffness;
+			for(int i = 0; i < 3; ++i) {
+				selfForce.col(contact.tri(i)) -= contact.w(i)*fc;
+				selfDiag(contact.tri(i)) += h2*selfStiffness*contact.w(i)*contact.w(i);
+			}
+		}
+		nSelfContacts += (int)local.size();
+	}
+}
+
+void Cloth::factorProjective(double h)
+{
+	// Q = M/h^2 + sum_s k_s (e_i - e_j)(e_i - e_j)^T over the free particles,
+	// the same for x, y, and z. Springs to pinned particles only keep their
+	// diagonal term; the pinned position moves to the right-hand side.
+	int nVerts = (int)pos.cols();
+	int nb = n/3;
+	vector<Triplet<double>> trips;
+	for(int k = 0; k < nVerts; ++k) {
+		if(!fixed[k]) {
+			trips.push_back(Triplet<double>(dofs[k]/3, dofs[k]/3, m(k)/(h*h)));
+		}
+	}
+	for(const Spring &s : springs) {
+		int b0 = fixed[s.i0] ? -1 : dofs[s.i0]/3;
+		int b1 = fixed[s.i1] ? -1 : dofs[s.i1]/3;
+		if(b0 >= 0) {
+			trips.push_back(Triplet<double>(b0, b0, s.E));
+		}
+		if(b1 >= 0) {
+			trips.push_back(Triplet<double>(b1, b1, s.E));
+		}
+		if(b0 >= 0 && b1 >= 0) {
+			trips.push_back(Triplet<double>(b0, b1, -s.E));
+			trips.push_back(Triplet<double>(b1, b0, -s.E));
+		}
+	}
+	SparseMatrix<double> Q(nb, nb);
+	Q.setFromTriplets(trips.begin(), trips.end());
+	
+	// The pattern never changes, so the ordering and symbolic analysis are
+	// only done the first time. A new time step only needs a numeric refactor.
+	if(!pdSolver) {
+		pdSolver = make_shared< SimplicialLLT< SparseMatrix<double> > >();
+		pdSolver->analyzePattern(Q);
+	}
+	pdSolver->factorize(Q);
+	assert(pdSolver->info() == Success);
+	pdH = h;
+}
+
+void Cloth::stepProjective(double h, const Vector3d &grav, const vector< shared_ptr<Particle> > &spheres)
+{
+	PROFILE_SCOPE("Cloth::stepProjective");
+	const double c = COLLISION_STIFFNESS;
+	const double h2 = h * h;
+	int nVerts = (int)pos.cols();
+	int nb = n/3;
+	Clock::time_point t = Clock::now();
+	if(h != pdH) {
+		factorProjective(h);
+	}
+	timings.compute += lap(t);
+	
+	// Inertial target y = x + h v + h^2 M^-1 f_ext, with gravity and the
+	// contact penalties evaluated at the start of the step
+	Matrix3Xd y = pos;
+	#pragma omp parallel for num_threads(nThreads)
+	for(int i = 0; i < nVerts; ++i) {
+		if(fixed[i]) {
+			continue;
+		}
+		Vector3d fext = m(i)*grav;
+		if(selfCollision) {
+			fext += selfForce.col(i);
+		}
+		const vector<int> *candidates = sphereHash->query(pos.col(i));
+		for(int jj = 0; candidates && jj < (int)candidates->size(); ++jj) {
+			const Particle &sphere = *spheres[(*candidates)[jj]];
+			Vector3d dx = pos.col(i) - sphere.x;
 			double l = dx.norm();
-			double d = particles[i]->r + spheres[j]->r - l;
-			if (d > 0)
-			{
-				f.segment(particles[i]->i, 3) += c * d * dx / l;
-				kTrips.push_back(Triplet<double>(particles[i]->i, particles[i]->i, c * d));
-				kTrips.push_back(Triplet<double>(particles[i]->i + 1, particles[i]->i + 1, c * d));
-				kTrips.push_back(Triplet<double>(particles[i]->i + 2, particles[i]->i + 2, c * d));
+			double d = r + sphere.r - l;
+			if(d > 0) {
+				fext += c*d*dx/l;
 			}
 		}
-		
-		// make mass matrix triplets, set gravity and initial velocity
-		if (!particles[i]->fixed)
+		Vector3d nor;
+		double d = colliderDepth(pos.col(i), nor);
+		if(d > 0) {
+			fext += c*d*nor;
+		}
+		y.col(i) += h*vel.col(i) + (h2/m(i))*fext;
+	}
+	
+	// Local/global iterations starting from the inertial target
+	Matrix3Xd x = y;
+	pdProj.resize(3, springs.size());
+	MatrixX3d rhs(nb, 3);
+	for(int it = 0; it < pdIterations; ++it) {
+		#pragma omp parallel num_threads(nThreads)
 		{
-			f.segment(particles[i]->i, 3) += particles[i]->m * grav;
-			v.segment(particles[i]->i, 3) = particles[i]->v;
-			mTrips.push_back(Triplet<double>(particles[i]->i, particles[i]->i, particles[i]->m));
-			mTrips.push_back(Triplet<double>(particles[i]->i + 1, particles[i]->i + 1, particles[i]->m));
-			mTrips.push_back(Triplet<double>(particles[i]->i + 2, particles[i]->i + 2, particles[i]->m));
+			// Local step: project each spring onto its rest length
+			#pragma omp for
+			for(int i = 0; i < (int)springs.size(); ++i) {
+				const Spring &s = springs[i];
+				Vector3d dx = x.col(s.i1) - x.col(s.i0);
+				pdProj.col(i) = (s.L/dx.norm())*dx;
+			}
+			
+			// Global step right-hand side, a color at a time
+			#pragma omp for
+			for(int i = 0; i < nVerts; ++i) {
+				if(!fixed[i]) {
+					rhs.row(dofs[i]/3) = (m(i)/h2)*y.col(i).transpose();
+				}
+			}
+			for(int color = 0; color + 1 < (int)colorStart.size(); ++color) {
+				#pragma omp for
+				for(int i = colorStart[color]; i < colorStart[color+1]; ++i) {
+					const Spring &s = springs[i];
+					Vector3d d = s.E*pdProj.col(i);
+					if(!fixed[s.i0]) {
+						rhs.row(dofs[s.i0]/3) -= d.transpose();
+						if(fixed[s.i1]) {
+							rhs.row(dofs[s.i0]/3) += s.E*x.col(s.i1).transpose();
+						}
+					}
+					if(!fixed[s.i1]) {
+						rhs.row(dofs[s.i1]/3) += d.transpose();
+						if(fixed[s.i0]) {
+							rhs.row(dofs[s.i1]/3) += s.E*x.col(s.i0).transpose();
+						}
+					}
+				}
+			}
+		}
+		
+		// Global step: back-substitution with the prefactored system
+		MatrixX3d xf = pdSolver->solve(rhs);
+		for(int i = 0; i < nVerts; ++i) {
+			if(!fixed[i]) {
+				x.col(i) = xf.row(dofs[i]/3).transpose();
+			}
+		}
+	}
+	iter = pdIterations;
+	err = 0.0;
+	timings.solve += lap(t);
+	
+	// set new position and velocity of particles
+	for(int i = 0; i < nVerts; ++i) {
+		if(!fixed[i]) {
+			vel.col(i) = (x.col(i) - pos.col(i))/h;
+			pos.col(i) = x.col(i);
+		}
+	}
+}
+
+void Cloth::setMatrixFree(bool matrixFree)
+{
+	this->matrixFree = matrixFree;
+	if(matrixFree) {
+		// The assembled system is not needed anymore, so release it
+		A = SparseMatrix<double, RowMajor>();
+		vector<int>().swap(diagBlockIdx);
+		vector<int>().swap(springBlockIdx);
+		Af = SparseMatrix<float, RowMajor>();
+		icSolver.reset();
+		icSolverF.reset();
+		ldlt.reset();
+	} else if(A.rows() != n && integrator == IMPLICIT_EULER) {
+		buildPattern();
+	}
+}
+
+void Cloth::step(double h, const Vector3d &grav, const vector< shared_ptr<Particle> > &spheres)
+{
+	PROFILE_SCOPE("Cloth::step");
+	// Collision detection
+	Clock::time_point t = Clock::now();
+	sphereHash->update(spheres, r);
+	findSelfContacts(h*h);
+	posPrev = pos;
+	timings.collision += lap(t);
+	
+	if(integrator == PROJECTIVE_DYNAMICS) {
+		stepProjective(h, grav, spheres);
+	} else {
+		stepImplicit(h, grav, spheres);
+	}
+	t = Clock::now();
+	resolveSweptContacts(h, spheres);
+	if(ccd) {
+		nSweptContacts += resolveColliderTunneling();
+	}
+	measureStep(spheres);
+	timings.collision += lap(t);
+	
+	// Update position and normal buffers
+	if(!buffersOnDemand || frames->takeRequest()) {
+		updatePosNor();
+	}
+	timings.buffers += lap(t);
+	++timings.steps;
+	PROFILE_COUNTER("Cloth iterations", iter);
+}
+
+void Cloth::resetTimings()
+{
+	double pattern = timings.pattern;
+	timings = Timings();
+	timings.pattern = pattern;
+}
+
+// Deepest penetration of a particle at x into the mesh colliders, and the
+// direction out of it, or 0 if it touches none
+double Cloth::colliderDepth(const Vector3d &x, Vector3d &nor) const
+{
+	double depth = 0.0;
+	for(const auto &collider : colliders) {
+		double d;
+		Vector3d grad;
+		if(collider->eval(x, d, grad) && r - d > depth && grad.squaredNorm() > 0.0) {
+			depth = r - d;
+			nor = grad.normalized();
 		}
 	}
+	return depth;
+}
 
-	M.setFromTriplets(mTrips.begin(), mTrips.end());
+// Earliest s in [0,1] at which a relative position a, moving by b, is
+// within distance R of the origin. s is 0 if it starts there.
+static bool sweptSphereHit(const Vector3d &a, const Vector3d &b, double R, double &s)
+{
+	double A = b.dot(b);
+	double B = a.dot(b);
+	double C = a.dot(a) - R*R;
+	if(C < 0.0) {
+		s = 0.0;
+		return true;
+	}
+	if(B >= 0.0 || A == 0.0) {
+		return false; // does not approach
+	}
+	double disc = B*B - A*C;
+	if(disc < 0.0) {
+		return false;
+	}
+	s = (-B - sqrt(disc))/A;
+	return s <= 1.0;
+}
 
+void Cloth::resolveSweptContacts(double h, const vector< shared_ptr<Particle> > &spheres)
+{
+	PROFILE_SCOPE("Cloth::resolveSweptContacts");
+	nSweptContacts = 0;
+	if(!ccd || spheres.empty()) {
+		return;
+	}
+	// A particle's path over the step stays within its displacement of its
+	// end position, so growing the swept spheres by that much lets the end
+	// position find them. It is rounded up to whole particle radii so that
+	// the hash is not rebuilt every step.
+	int nVerts = (int)pos.cols();
+	double dmax = 0.0;
+	#pragma omp parallel for reduction(max:dmax) num_threads(nThreads)
+	for(int i = 0; i < nVerts; ++i) {
+		dmax = max(dmax, (pos.col(i) - posPrev.col(i)).norm());
+	}
+	sweptHash->update(spheres, r*(ceil(dmax/r) + 1.0), h);
+	
+	// Spheres move linearly from x - h v to x over the step, and so do the
+	// particles. Contacts that end less than a particle radius deep along
+	// the normal at impact are left to the penalty forces. Deeper ones are
+	// more than the soft penalty can push back out, so the particle is
+	// stopped on the surface at the time of impact (the start of the step if
+	// it was already inside) and slides for the rest of the step without the
+	// approaching relative velocity.
+	int count = 0;
+	#pragma omp parallel for reduction(+:count) num_threads(nThreads)
+	for(int i = 0; i < nVerts; ++i) {
+		if(fixed[i]) {
+			continue;
+		}
+		const vector<int> *candidates = sweptHash->query(pos.col(i));
+		double sHit = 2.0;
+		int jHit = -1;
+		for(int jj = 0; candidates && jj < (int)candidates->size(); ++jj) {
+			const Particle &sphere = *spheres[(*candidates)[jj]];
+			double R = r + sphere.r;
+			Vector3d a = posPrev.col(i) - (sphere.x - h*sphere.v);
+			Vector3d b = (pos.col(i) - sphere.x) - a;
+			double s;
+			if(!sweptSphereHit(a, b, R, s) || s >= sHit) {
+				continue;
+			}
+			Vector3d d = a + s*b;
+			double l = d.norm();
+			if(l == 0.0 || (a + b).dot(d)/l > R - r) {
+				continue;
+			}
+			sHit = s;
+			jHit = (*candidates)[jj];
+		}
+		if(jHit < 0) {
+			continue;
+		}
+		const Particle &sphere = *spheres[jHit];
+		double R = r + sphere.r;
+		Vector3d a = posPrev.col(i) - (sphere.x - h*sphere.v);
+		Vector3d b = (pos.col(i) - sphere.x) - a;
+		Vector3d nor = (a + sHit*b).normalized();
+		Vector3d vrel = b/h;
+		double vn = vrel.dot(nor);
+		if(vn < 0.0) {
+			vrel -= vn*nor;
+		}
+		pos.col(i) = sphere.x + R*nor + (1.0 - sHit)*h*vrel;
+		vel.col(i) = sphere.v + vrel;
+		// The next solve starts from v, so it must see the new velocity too
+		v.segment<3>(dofs[i]) = vel.col(i);
+		++count;
+	}
+	nSweptContacts = count;
+}
+
+int Cloth::resolveColliderTunneling()
+{
+	PROFILE_SCOPE("Cloth::resolveColliderTunneling");
+	// A distance field only has values within its band of the surface, so a
+	// particle that crossed the whole inner half of the band in one step
+	// gets no contact at the end of it. Walk the step from the previous
+	// position in steps of one cell, which cannot skip the band, and if the
+	// last point in the band is inside, the particle went through the
+	// surface there: put it back at its radius outside, along the gradient,
+	// without the inward velocity.
+	int nVerts = (int)pos.cols();
+	int count = 0;
+	for(const auto &collider : colliders) {
+		double cell = collider->getCellSize();
+		#pragma omp parallel for reduction(+:count) num_threads(nThreads)
+		for(int i = 0; i < nVerts; ++i) {
+			double d;
+			Vector3d grad;
+			if(fixed[i] || collider->eval(pos.col(i), d, grad)) {
+				continue;
+			}
+			Vector3d x0 = posPrev.col(i);
+			Vector3d dx = pos.col(i) - x0;
+			int steps = (int)ceil(dx.norm()/cell);
+			bool inBand = false;
+			Vector3d x;
+			double dLast = 0.0;
+			Vector3d gradLast;
+			for(int k = 0; k < steps; ++k) {
+				Vector3d xk = x0 + (double)k/steps*dx;
+				if(collider->eval(xk, d, grad)) {
+					inBand = true;
+					x = xk;
+					dLast = d;
+					gradLast = grad;
+				}
+			}
+			if(!inBand || dLast >= 0.0 || gradLast.squaredNorm() == 0.0) {
+				continue;
+			}
+			Vector3d nor = gradLast.normalized();
+			pos.col(i) = x + (r - dLast)*nor;
+			double vn = vel.col(i).dot(nor);
+			if(vn < 0.0) {
+				vel.col(i) -= vn*nor;
+			}
+			if(dofs[i] >= 0) {
+				v.segment<3>(dofs[i]) = vel.col(i);
+			}
+			++count;
+		}
+	}
+	return count;
+}
 
-	// get spring forces between particles
-	for (int i = 0; i < springs.size(); i++)
+void Cloth::measureStep(const vector< shared_ptr<Particle> > &spheres)
+{
+	// Largest spring strain rate |dl/dt|/L and deepest sphere penetration at
+	// the end of the step, for the time step controller
+	double rate = 0.0;
+	double depth = 0.0;
+	int nVerts = (int)pos.cols();
+	#pragma omp parallel num_threads(nThreads)
 	{
-		shared_ptr<Particle> p0 = springs[i]->p0;
-		shared_ptr<Particle> p1 = springs[i]->p1;
-		Vector3d dx = p1->x - p0->x;
-
-		// spring force between particles
-		double l = dx.norm();
-		double lscale = (l - springs[i]->L) / l;
-		VectorXd fs = springs[i]->E * lscale * dx;
-		if (!p0->fixed)
-		{
-			f.segment(p0->i, 3) += fs;
+		#pragma omp for reduction(max:rate)
+		for(int i = 0; i < (int)springs.size(); ++i) {
+			const Spring &s = springs[i];
+			Vector3d dx = pos.col(s.i1) - pos.col(s.i0);
+			Vector3d dv = vel.col(s.i1) - vel.col(s.i0);
+			double l = dx.norm();
+			rate = max(rate, abs(dx.dot(dv))/(l*s.L));
 		}
-		if (!p1->fixed)
-		{
-			f.segment(p1->i, 3) += -fs;
+		#pragma omp for reduction(max:depth)
+		for(int i = 0; i < nVerts; ++i) {
+			const vector<int> *candidates = sphereHash->query(pos.col(i));
+			for(int jj = 0; candidates && jj < (int)candidates->size(); ++jj) {
+				const Particle &sphere = *spheres[(*candidates)[jj]];
+				double d = r + sphere.r - (pos.col(i) - sphere.x).norm();
+				depth = max(depth, d);
+			}
+			Vector3d nor;
+			depth = max(depth, colliderDepth(pos.col(i), nor));
 		}
+	}
+	maxStrainRate = rate;
+	maxPenetration = depth;
+}
 
-		// k matrix stuff
-		MatrixXd Ks = (springs[i]->E / (l * l)) * ((1 - lscale) * (dx * dx.transpose()) + (lscale * (dx.dot(dx))) * Matrix3d::Identity());
-		if (!p0->fixed)
+void Cloth::stepImplicit(double h, const Vector3d &grav, const vector< shared_ptr<Particle> > &spheres)
+{
+	PROFILE_SCOPE("Cloth::stepImplicit");
+	const double c = COLLISION_STIFFNESS;
+	const double h2 = h * h;
+	Clock::time_point t = Clock::now();
+	
+	// store previous velocity to help solve later
+	VectorXd pv = v;
+	f.setZero();
+	
+	// Write the values of M - h^2 K straight into the cached pattern, or into
+	// the compact per-particle/per-spring form used by the matrix-free operator
+	double *values = A.valuePtr();
+	if (!matrixFree)
+	{
+		fill(values, values + A.nonZeros(), 0.0);
+	}
+	int nVerts = (int)pos.cols();
+	#pragma omp parallel num_threads(nThreads)
+	{
+		#pragma omp for
+		for (int i = 0; i < nVerts; i++)
 		{
-			for (int j = 0; j < Ks.rows(); j++)
+			if (fixed[i])
 			{
-				for (int k = 0; k < Ks.cols(); k++)
-				{
-					kTrips.push_back(Triplet<double>(p0->i + j, p0->i + k, -Ks(j, k)));
-				}
+				continue;
 			}
-		}
+			int di = dofs[i];
+		
+			// mass, gravity, and initial velocity
+			f.segment<3>(di) += m(i) * grav;
+			v.segment<3>(di) = vel.col(i);
+			double diag = m(i);
 
-		if (!p1->fixed)
-		{
-			for (int j = 0; j < Ks.rows(); j++)
+			// self-collision penalty forces
+			if (selfCollision)
 			{
-				for (int k = 0; k < Ks.cols(); k++)
+				f.segment<3>(di) += selfForce.col(i);
+				diag += selfDiag(i);
+			}
+
+			// forces spheres have on cloth, for the candidates from the broad phase
+			const vector<int> *candidates = sphereHash->query(pos.col(i));
+			for (int jj = 0; candidates && jj < (int)candidates->size(); jj++)
+			{
+				int j = (*candidates)[jj];
+				Vector3d dx = pos.col(i) - spheres[j]->x;
+				double l = dx.norm();
+				double d = r + spheres[j]->r - l;
+				if (d > 0)
 				{
-					kTrips.push_back(Triplet<double>(p1->i + j, p1->i + k, -Ks(j, k)));
+					f.segment<3>(di) += c * d * dx / l;
+					diag -= h2 * c * d;
 				}
 			}
+
+			// and the mesh colliders
+			Vector3d nor;
+			double d = colliderDepth(pos.col(i), nor);
+			if (d > 0)
+			{
+				f.segment<3>(di) += c * d * nor;
+				diag -= h2 * c * d;
+			}
+			if (matrixFree)
+			{
+				op->diag(di / 3) = diag;
+			}
+			else
+			{
+				const int *idx = &diagBlockIdx[3*i];
+				values[idx[0]] += diag;
+				values[idx[1] + 1] += diag;
+				values[idx[2] + 2] += diag;
+			}
 		}
 
-		if (!p0->fixed && !p1->fixed)
+		// get spring forces between particles, one color at a time so that no
+		// two threads ever write to the same particle
+		for (int color = 0; color + 1 < (int)colorStart.size(); color++)
 		{
-
-			for (int j = 0; j < Ks.rows(); j++)
+			#pragma omp for
+			for (int i = colorStart[color]; i < colorStart[color + 1]; i++)
 			{
-				for (int k = 0; k < Ks.cols(); k++)
+				const Spring &s = springs[i];
+				int d0 = dofs[s.i0];
+				int d1 = dofs[s.i1];
+				Vector3d dx = pos.col(s.i1) - pos.col(s.i0);
+
+				// spring force between particles
+				double l = dx.norm();
+				double lscale = (l - s.L) / l;
+				Vector3d fs = s.E * lscale * dx;
+				if (!fixed[s.i0])
+				{
+					f.segment<3>(d0) += fs;
+				}
+				if (!fixed[s.i1])
+				{
+					f.segment<3>(d1) -= fs;
+				}
+
+				// stiffness block, pre-scaled by h^2: a dx dx^T + b I. A compressed
+				// spring would make b negative and the system indefinite, which
+				// stalls CG on fine grids, so its transverse term is dropped.
+				double a = (h2 * s.E / (l * l)) * (1 - lscale);
+				double b = (h2 * s.E / (l * l)) * max(0.0, lscale * (dx.dot(dx)));
+				if (matrixFree)
 				{
-					kTrips.push_back(Triplet<double>(p0->i + j, p1->i + k, Ks(j, k)));
-					kTrips.push_back(Triplet<double>(p1->i + j, p0->i + k, Ks(j, k)));
+					ClothOperator::SpringJacobian &J = op->springs[i];
+					J.dx = dx;
+					J.a = a;
+					J.b = b;
+					continue;
+				}
+				Matrix3d Ks = a * (dx * dx.transpose()) + b * Matrix3d::Identity();
+				if (!fixed[s.i0])
+				{
+					addBlock(values, &diagBlockIdx[3*s.i0], Ks);
+				}
+				if (!fixed[s.i1])
+				{
+					addBlock(values, &diagBlockIdx[3*s.i1], Ks);
+				}
+				if (!fixed[s.i0] && !fixed[s.i1])
+				{
+					Ks = -Ks;
+					addBlock(values, &springBlockIdx[6*i], Ks);
+					addBlock(values, &springBlockIdx[6*i+3], Ks);
 				}
 			}
 		}
 	}
 
-	K.setFromTriplets(kTrips.begin(), kTrips.end());
-
 	// solve sparse matrices
-	VectorXd b = M * v + h * f;
-	ConjugateGradient< SparseMatrix<double> > cg;
-	cg.setMaxIterations(25);
-	cg.setTolerance(1e-6);
-	cg.compute(M - (h * h) * K);
-	v = cg.solveWithGuess(b, pv);
-
-	// set new position and velocity of particles
-	for (int i = 0; i < particles.size(); i++)
+	VectorXd b(n);
+	for (int i = 0; i < nVerts; i++)
 	{
-		if (!particles[i]->fixed)
+		if (!fixed[i])
 		{
-			particles[i]->v = v.segment(particles[i]->i, 3);
-			particles[i]->x = particles[i]->x + particles[i]->v * h;
+			b.segment<3>(dofs[i]) = m(i) * v.segment<3>(dofs[i]) + h * f.segment<3>(dofs[i]);
 		}
 	}
+	timings.assembly += lap(t);
+	// The spectrum of M - h^2 K scales with h^2, so the Chebyshev bounds only
+	// carry over between steps of the same size
+	if(h != chebyshevH) {
+		chebyshev->invalidate();
+		chebyshevH = h;
+	}
+	solve(b, pv);
 
-	// Update position and normal buffers
-	updatePosNor();
-}
-
-void Cloth::init()
-{
-	glGenBuffers(1, &posBufID);
-	glBindBuffer(GL_ARRAY_BUFFER, posBufID);
-	glBufferData(GL_ARRAY_BUFFER, posBuf.size()*sizeof(float), &posBuf[0], GL_DYNAMIC_DRAW);
-	
-	glGenBuffers(1, &norBufID);
-	glBindBuffer(GL_ARRAY_BUFFER, norBufID);
-	glBufferData(GL_ARRAY_BUFFER, norBuf.size()*sizeof(float), &norBuf[0], GL_DYNAMIC_DRAW);
-	
-	glGenBuffers(1, &texBufID);
-	glBindBuffer(GL_ARRAY_BUFFER, texBufID);
-	glBufferData(GL_ARRAY_BUFFER, texBuf.size()*sizeof(float), &texBuf[0], GL_STATIC_DRAW);
-	
-	glGenBuffers(1, &eleBufID);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, eleBufID);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, eleBuf.size()*sizeof(unsigned int), &eleBuf[0], GL_STATIC_DRAW);
-	
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-	
-	assert(glGetError() == GL_NO_ERROR);
-}
-
-void Cloth::draw(shared_ptr<MatrixStack> MV, const shared_ptr<Program> p) const
-{
-	// Draw mesh
-	glUniform3fv(p->getUniform("kdFront"), 1, Vector3f(1.0, 0.0, 0.0).data());
-	glUniform3fv(p->getUniform("kdBack"),  1, Vector3f(1.0, 1.0, 0.0).data());
-	MV->pushMatrix();
-	glUniformMatrix4fv(p->getUniform("MV"), 1, GL_FALSE, glm::value_ptr(MV->topMatrix()));
-	int h_pos = p->getAttribute("aPos");
-	glEnableVertexAttribArray(h_pos);
-	glBindBuffer(GL_ARRAY_BUFFER, posBufID);
-	glBufferData(GL_ARRAY_BUFFER, posBuf.size()*sizeof(float), &posBuf[0], GL_DYNAMIC_DRAW);
-	glVertexAttribPointer(h_pos, 3, GL_FLOAT, GL_FALSE, 0, (const void *)0);
-	int h_nor = p->getAttribute("aNor");
-	glEnableVertexAttribArray(h_nor);
-	glBindBuffer(GL_ARRAY_BUFFER, norBufID);
-	glBufferData(GL_ARRAY_BUFFER, norBuf.size()*sizeof(float), &norBuf[0], GL_DYNAMIC_DRAW);
-	glVertexAttribPointer(h_nor, 3, GL_FLOAT, GL_FALSE, 0, (const void *)0);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, eleBufID);
-	for(int i = 0; i < rows; ++i) {
-		glDrawElements(GL_TRIANGLE_STRIP, 2*cols, GL_UNSIGNED_INT, (const void *)(2*cols*i*sizeof(unsigned int)));
+	// set new position and velocity of particles
+	for (int i = 0; i < nVerts; i++)
+	{
+		if (!fixed[i])
+		{
+			vel.col(i) = v.segment<3>(dofs[i]);
+			pos.col(i) += vel.col(i) * h;
+		}
 	}
-	glDisableVertexAttribArray(h_nor);
-	glDisableVertexAttribArray(h_pos);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-	MV->popMatrix();
 }
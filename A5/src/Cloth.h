@@ -4,57 +4,296 @@
 
 #include <vector>
 #include <memory>
+#include <string>
 
 #define EIGEN_DONT_ALIGN_STATICALLY
 #include <Eigen/Dense>
 #include <Eigen/Sparse>
 
+#include "Spring.h"
+#include "TripleBuffer.h"
+#include "BufferUploader.h"
+
 class Particle;
-class Spring;
 class MatrixStack;
 class Program;
+class ClothOperator;
+class SpatialHash;
+class BVH;
+class ChebyshevSolver;
+class DistanceField;
+template<typename Scalar> class MultigridPreconditioner;
 
 class Cloth
 {
 public:
 	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
 	
+	enum Preconditioner
+	{
+		NO_PRECONDITIONER,
+		JACOBI,
+		BLOCK_JACOBI,        // per-particle 3x3 blocks
+		INCOMPLETE_CHOLESKY, // assembled system only, block-Jacobi when matrix-free
+		MULTIGRID            // V-cycle on the grid (see MultigridPreconditioner), block-Jacobi for meshes or when matrix-free
+	};
+	
+	enum Precision
+	{
+		DOUBLE_PRECISION,
+		SINGLE_PRECISION, // CG entirely in float
+		MIXED_PRECISION   // float CG inside double-precision iterative refinement
+	};
+	
+	enum Solver
+	{
+		CONJUGATE_GRADIENT,
+		CHEBYSHEV,          // block-Jacobi Chebyshev semi-iteration, spectrum bounds reused across steps
+		DIRECT              // sparse LDL^T of the assembled system, CG when matrix-free
+	};
+	
+	enum Integrator
+	{
+		IMPLICIT_EULER,     // linearized implicit Euler, CG on M - h^2 K
+		PROJECTIVE_DYNAMICS // local spring projections and a prefactored global solve
+	};
+	
 	Cloth(int rows, int cols,
 		  const Eigen::Vector3d &x00,
 		  const Eigen::Vector3d &x01,
 		  const Eigen::Vector3d &x10,
 		  const Eigen::Vector3d &x11,
 		  double mass,
-		  double stiffness);
+		  double stiffness,
+		  Integrator integrator = IMPLICIT_EULER);
+	// Cloth from the triangles of an OBJ file, with the given OBJ vertex
+	// indices (0-based) pinned
+	Cloth(const std::string &meshName,
+		  const std::vector<int> &pinned,
+		  double mass,
+		  double stiffness,
+		  Integrator integrator = IMPLICIT_EULER);
 	virtual ~Cloth();
 	
 	void tare();
 	void reset();
 	void updatePosNor();
-	void step(double h, const Eigen::Vector3d &grav, const std::vector< std::shared_ptr<Particle> > spheres);
+	void step(double h, const Eigen::Vector3d &grav, const std::vector< std::shared_ptr<Particle> > &spheres);
+	
+	int getNumParticles() const { return (int)pos.cols(); }
+	// Writes the simulation state, the solver settings, and the spring
+	// topology to a versioned binary file of raw arrays
+	bool saveCheckpoint(const std::string &filename) const;
+	// Restores a saved cloth from a mapping of the file, without generating or
+	// coloring any springs. Returns null if the file is not a checkpoint.
+	static std::shared_ptr<Cloth> loadCheckpoint(const std::string &filename);
+	// Shows the given positions without simulating, e.g. for cache playback
+	void setPositions(const Eigen::Matrix3Xd &x);
+	const Eigen::Matrix3Xd &getPositions() const { return pos; }
+	const Eigen::Matrix3Xd &getVelocities() const { return vel; }
+	const Eigen::VectorXd &getMasses() const { return m; }
+	// Springs sorted by color. Springs of color c, [colorStart[c], colorStart[c+1]),
+	// share no particle.
+	const std::vector<Spring> &getSprings() const { return springs; }
+	const std::vector<int> &getColorStart() const { return colorStart; }
+	
+	Integrator getIntegrator() const { return integrator; }
+	// Local/global iterations per projective dynamics step
+	void setProjectiveIterations(int iterations) { pdIterations = iterations; }
+	
+	// Solve with a matrix-free operator instead of assembling M - h^2 K
+	void setMatrixFree(bool matrixFree);
+	bool isMatrixFree() const { return matrixFree; }
+	
+	// Conjugate gradient settings and the statistics of the last solve
+	void setSolver(Solver solver) { this->solver = solver; }
+	void setPreconditioner(Preconditioner precond) { this->precond = precond; }
+	void setMaxIterations(int iterMax) { this->iterMax = iterMax; }
+	void setTolerance(double tol) { this->tol = tol; }
+	// Precision of the assembled solve; the matrix-free solve is always double
+	void setPrecision(Precision precision) { this->precision = precision; }
+	int getMaxIterations() const { return iterMax; }
+	double getTolerance() const { return tol; }
+	// Iterations of the last solve, including any CG fallback after Chebyshev
+	int getIterations() const { return iter; }
+	// Operator products the last solve spent estimating the Chebyshev
+	// spectrum bounds. 0 when the bounds were reused, and for the other solvers.
+	int getEstimateProducts() const { return estimateIter; }
+	double getError() const { return err; }
+	// Largest spring strain rate (1/s) and sphere penetration depth after the last step
+	double getMaxStrainRate() const { return maxStrainRate; }
+	double getMaxPenetration() const { return maxPenetration; }
+	
+	// Wall-clock time of each phase of step(), accumulated in seconds until
+	// resetTimings(). pattern is the one-time setup of the sparsity pattern.
+	struct Timings
+	{
+		double collision;    // sphere hash and self-collision contacts
+		double assembly;     // forces and the system matrix
+		double pattern;      // sparsity pattern of A
+		double compute;      // preconditioner or factorization setup
+		double solve;        // iterations
+		double buffers;      // updatePosNor
+		int steps;
+	};
+	const Timings &getTimings() const { return timings; }
+	void resetTimings();
+	
+	// Vertex-triangle self-collision, off by default
+	void setSelfCollision(bool selfCollision);
+	void setSelfCollisionThickness(double thickness) { selfThickness = thickness; }
+	void setSelfCollisionStiffness(double stiffness);
+	int getSelfContacts() const { return nSelfContacts; }
 	
+	// Swept sphere-particle collisions: particles whose path over a step
+	// passes through a (moving) sphere are stopped at the time of impact, so
+	// that fast spheres do not tunnel through the cloth. On by default; it
+	// only changes a step in which a particle ends deeper than its radius.
+	void setContinuousCollision(bool ccd) { this->ccd = ccd; }
+	int getSweptContacts() const { return nSweptContacts; }
+	
+	// Static mesh colliders, as signed distance fields. Particles closer than
+	// their radius get the same penalty force as with the spheres. With
+	// continuous collision on, a particle that crosses a collider's whole
+	// narrow band in one step is put back on the surface where it went in.
+	void setColliders(const std::vector< std::shared_ptr<DistanceField> > &colliders) { this->colliders = colliders; }
+	
+	// Only fill the position/normal buffers after a step when the renderer has
+	// asked for a new frame, instead of after every step
+	void setBuffersOnDemand(bool onDemand) { buffersOnDemand = onDemand; }
+	
+	// Number of threads used for assembly and matrix-free products (OpenMP builds only)
+	void setNumThreads(int nThreads);
+	int getNumThreads() const { return nThreads; }
+	
+	// Replaces the GL upload path, e.g. with a MockBufferUploader. Call
+	// before init() or initBuffers().
+	void setUploader(std::shared_ptr<BufferUploader> uploader) { this->uploader = uploader; }
+	const std::shared_ptr<BufferUploader> &getUploader() const { return uploader; }
+	// Hands the element indices and the latest frame to the uploader. init()
+	// calls this, after creating a GL uploader if none was set.
+	void initBuffers();
+	// Uploads the latest published frame, if it is new, and asks the stepper
+	// for the next one. draw() calls this.
+	void uploadFrame() const;
 	void init();
 	void draw(std::shared_ptr<MatrixStack> MV, const std::shared_ptr<Program> p) const;
 	
 private:
-	int rows;
+	void colorSprings();
+	void buildPattern();
+	void findSelfContacts(double h2);
+	void solve(const Eigen::VectorXd &b, const Eigen::VectorXd &guess);
+	void stepImplicit(double h, const Eigen::Vector3d &grav, const std::vector< std::shared_ptr<Particle> > &spheres);
+	void stepProjective(double h, const Eigen::Vector3d &grav, const std::vector< std::shared_ptr<Particle> > &spheres);
+	void factorProjective(double h);
+	double colliderDepth(const Eigen::Vector3d &x, Eigen::Vector3d &nor) const;
+	void resolveSweptContacts(double h, const std::vector< std::shared_ptr<Particle> > &spheres);
+	int resolveColliderTunneling();
+	void measureStep(const std::vector< std::shared_ptr<Particle> > &spheres);
+	
+	Cloth();
+	void setDefaults(Integrator integrator);
+	void setup(double stiffness);
+	
+	int rows; // 0 for a cloth loaded from a mesh
 	int cols;
 	int n;
-	std::vector< std::shared_ptr<Particle> > particles;
-	std::vector< std::shared_ptr<Spring> > springs;
+	Integrator integrator;
+	
+	// Particle state, stored as structure-of-arrays (one column/entry per particle)
+	double r;                // particle radius (used for collisions)
+	Eigen::Matrix3Xd pos;    // positions
+	Eigen::Matrix3Xd vel;    // velocities
+	Eigen::Matrix3Xd pos0;   // tared positions
+	Eigen::Matrix3Xd vel0;   // tared velocities
+	Eigen::VectorXd m;       // masses
+	std::vector<int> dofs;   // starting index into the DOF vectors, -1 if fixed
+	std::vector<char> fixed;
+	std::vector<Spring> springs;     // sorted by color
+	std::vector<int> colorStart;     // springs of color c are [colorStart[c], colorStart[c+1])
+	std::shared_ptr<SpatialHash> sphereHash; // broad phase for sphere collisions
+	std::shared_ptr<SpatialHash> sweptHash;  // broad phase over the paths of the spheres
+	bool ccd;
+	int nSweptContacts;
+	Eigen::Matrix3Xd posPrev; // positions at the start of the step
+	std::vector< std::shared_ptr<DistanceField> > colliders;
+	
+	bool selfCollision;
+	double selfThickness;
+	double selfStiffness;
+	int nSelfContacts;
+	std::shared_ptr<BVH> bvh;     // over tris, refit every step
+	std::vector<int> adjStart;    // particles connected to particle k by a spring are
+	std::vector<int> adj;         // adj[adjStart[k]..adjStart[k+1]), sorted
+	Eigen::Matrix3Xd selfForce;   // per-particle self-collision force
+	Eigen::VectorXd selfDiag;     // per-particle self-collision term of M - h^2 K
+	int nThreads;
 	
 	Eigen::VectorXd v;
 	Eigen::VectorXd f;
-	Eigen::SparseMatrix<double> M;
-	Eigen::SparseMatrix<double> K;
 	
-	std::vector<unsigned int> eleBuf;
-	std::vector<float> posBuf;
-	std::vector<float> norBuf;
+	// System matrix M - h^2 K. Its sparsity pattern is fixed by the spring
+	// topology, so it is built once and only the values are rewritten each step.
+	Eigen::SparseMatrix<double, Eigen::RowMajor> A;
+	Eigen::SparseMatrix<float, Eigen::RowMajor> Af; // same pattern, for the float solves
+	std::vector<int> diagBlockIdx;   // 3 per particle: value index of each row of its diagonal block
+	std::vector<int> springBlockIdx; // 6 per spring: rows of the (i0,i1) then (i1,i0) blocks, -1 if a particle is fixed
+	
+	bool matrixFree;
+	std::shared_ptr<ClothOperator> op;
+	Solver solver;
+	std::shared_ptr<ChebyshevSolver> chebyshev;
+	Preconditioner precond;
+	Precision precision;
+	// Kept across steps so the fill-reducing ordering of the fixed pattern is computed once
+	template<typename Scalar>
+	using ICSolver = Eigen::ConjugateGradient< Eigen::SparseMatrix<Scalar, Eigen::RowMajor>, Eigen::Lower|Eigen::Upper,
+		Eigen::IncompleteCholesky< Scalar, Eigen::Lower, Eigen::AMDOrdering<int> > >;
+	std::shared_ptr< ICSolver<double> > icSolver;
+	// The ordering and symbolic factorization only depend on the pattern of
+	// A, so they are computed once and only the numeric factorization is
+	// redone each step
+	std::shared_ptr< Eigen::SimplicialLDLT< Eigen::SparseMatrix<double, Eigen::RowMajor>, Eigen::Lower, Eigen::AMDOrdering<int> > > ldlt;
+	std::shared_ptr< ICSolver<float> > icSolverF;
+	// Grid transfer operators of a grid cloth, built with the pattern of A
+	std::shared_ptr< MultigridPreconditioner<double> > multigrid;
+	std::shared_ptr< MultigridPreconditioner<float> > multigridF;
+	
+	// Projective dynamics: the system only depends on h, the masses and the
+	// springs, so it is factored once and refactored only when h changes
+	int pdIterations;
+	double pdH;
+	std::shared_ptr< Eigen::SimplicialLLT< Eigen::SparseMatrix<double> > > pdSolver;
+	Eigen::Matrix3Xd pdProj; // projected spring vectors
+	
+	int iterMax;
+	double tol;
+	int iter;
+	int estimateIter;
+	double err;
+	double chebyshevH; // time step the Chebyshev spectrum bounds were estimated for
+	double maxStrainRate;
+	double maxPenetration;
+	Timings timings;
+	
+	std::vector<unsigned int> eleBuf; // one strip per grid row separated by restarts, or triangles
+	std::vector<Eigen::Vector3i> tris;
+	std::vector<int> vertTriStart; // triangles around each vertex of a mesh
+	std::vector<int> vertTris;
+	Eigen::Matrix3Xd triNor;
+	// Position and normal buffers of one simulated frame. The stepper thread
+	// publishes them and the render thread draws the latest one.
+	struct Frame
+	{
+		std::vector<float> posBuf;
+		std::vector<float> norBuf;
+	};
+	std::shared_ptr< TripleBuffer<Frame> > frames;
+	bool buffersOnDemand;
+	Eigen::MatrixX3d posSoA; // positions as separate x, y, z columns for the normal kernel
 	std::vector<float> texBuf;
-	unsigned eleBufID;
-	unsigned posBufID;
-	unsigned norBufID;
+	std::shared_ptr<BufferUploader> uploader;
 	unsigned texBufID;
 };
 
@@ -0,0 +1,42 @@
+#include <cassert>
+
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "Cloth.h"
+#include "MatrixStack.h"
+#include "Program.h"
+#include "GLSL.h"
+#include "GLBufferUploader.h"
+
+using namespace std;
+using namespace Eigen;
+
+void Cloth::init()
+{
+	if(!uploader) {
+		uploader = make_shared<GLBufferUploader>();
+	}
+	initBuffers();
+	
+	glGenBuffers(1, &texBufID);
+	glBindBuffer(GL_ARRAY_BUFFER, texBufID);
+	glBufferData(GL_ARRAY_BUFFER, texBuf.size()*sizeof(float), &texBuf[0], GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	
+	assert(glGetError() == GL_NO_ERROR);
+}
+
+void Cloth::draw(shared_ptr<MatrixStack> MV, const shared_ptr<Program> p) const
+{
+	// Draw mesh
+	glUniform3fv(p->getUniform("kdFront"), 1, Vector3f(1.0, 0.0, 0.0).data());
+	glUniform3fv(p->getUniform("kdBack"),  1, Vector3f(1.0, 1.0, 0.0).data());
+	MV->pushMatrix();
+	glUniformMatrix4fv(p->getUniform("MV"), 1, GL_FALSE, glm::value_ptr(MV->topMatrix()));
+	uploadFrame();
+	// The whole sheet in one call
+	uploader->draw(p->getAttribute("aPos"), p->getAttribute("aNor"));
+	MV->popMatrix();
+}
@@ -0,0 +1,90 @@
+#include <cassert>
+
+#include "ClothOperator.h"
+
+using namespace std;
+using namespace Eigen;
+
+ClothOperator::ClothOperator() :
+	n(0),
+	nThreads(1)
+{
+}
+
+ClothOperator::~ClothOperator()
+{
+}
+
+void ClothOperator::init(int n, const vector<int> &springDofs0, const vector<int> &springDofs1,
+						 const vector<int> &colorStart)
+{
+	assert(n % 3 == 0);
+	assert(springDofs0.size() == springDofs1.size());
+	assert(colorStart.back() == (int)springDofs0.size());
+	this->n = n;
+	this->colorStart = colorStart;
+	diag.setZero(n/3);
+	springs.resize(springDofs0.size());
+	for(int i = 0; i < (int)springs.size(); ++i) {
+		springs[i].dx.setZero();
+		springs[i].a = 0.0;
+		springs[i].b = 0.0;
+		springs[i].d0 = springDofs0[i];
+		springs[i].d1 = springDofs1[i];
+	}
+}
+
+void ClothOperator::getDiagonalBlocks(Matrix3Xd &D) const
+{
+	D.setZero(3, n);
+	for(int k = 0; k < (int)diag.size(); ++k) {
+		D.block<3,3>(0, 3*k).diagonal().setConstant(diag(k));
+	}
+	for(const SpringJacobian &s : springs) {
+		Matrix3d Ks = s.a*s.dx*s.dx.transpose() + s.b*Matrix3d::Identity();
+		if(s.d0 >= 0) {
+			D.block<3,3>(0, s.d0) += Ks;
+		}
+		if(s.d1 >= 0) {
+			D.block<3,3>(0, s.d1) += Ks;
+		}
+	}
+}
+
+void ClothOperator::addProduct(const Ref<const VectorXd> &x, Ref<VectorXd> y, double alpha) const
+{
+	assert(x.rows() == n);
+	assert(y.rows() == n);
+	
+	#pragma omp parallel num_threads(nThreads)
+	{
+		// Mass and contact terms
+		#pragma omp for
+		for(int k = 0; k < (int)diag.size(); ++k) {
+			y.segment<3>(3*k) += (alpha*diag(k)) * x.segment<3>(3*k);
+		}
+		
+		// Spring terms: h^2 Ks (x0 - x1) on the first particle, the negation on
+		// the second. Springs of one color share no particles.
+		for(int c = 0; c + 1 < (int)colorStart.size(); ++c) {
+			#pragma omp for
+			for(int i = colorStart[c]; i < colorStart[c+1]; ++i) {
+				const SpringJacobian &s = springs[i];
+				Vector3d dxx = Vector3d::Zero();
+				if(s.d0 >= 0) {
+					dxx += x.segment<3>(s.d0);
+				}
+				if(s.d1 >= 0) {
+					dxx -= x.segment<3>(s.d1);
+				}
+				Vector3d w = alpha*(s.a*s.dx.dot(dxx)*s.dx + s.b*dxx);
+				if(s.d0 >= 0) {
+					y.segment<3>(s.d0) += w;
+				}
+				if(s.d1 >= 0) {
+					y.segment<3>(s.d1) -= w;
+				}
+			}
+		}
+	}
+}
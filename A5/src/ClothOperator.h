@@ -0,0 +1,99 @@
+#pragma once
+#ifndef ClothOperator_H
+#define ClothOperator_H
+
+#include <vector>
+
+#define EIGEN_DONT_ALIGN_STATICALLY
+#include <Eigen/Dense>
+#include <Eigen/Sparse>
+
+class ClothOperator;
+
+namespace Eigen {
+namespace internal {
+	// ClothOperator behaves like a sparse matrix as far as the iterative solvers are concerned
+	template<> struct traits<ClothOperator> : public Eigen::internal::traits< Eigen::SparseMatrix<double> > {};
+}
+}
+
+/**
+ * Matrix-free form of the implicit cloth system M - h^2 K.
+ * The global matrix is never stored: each product loops over the springs
+ * and applies their 3x3 Jacobians on the fly from a compact per-spring form
+ *    h^2 Ks = a dx dx^T + b I,
+ * plus a per-particle diagonal holding the mass and contact terms.
+ * The DOFs of each particle are assumed to be contiguous and 3-aligned.
+ */
+class ClothOperator : public Eigen::EigenBase<ClothOperator>
+{
+public:
+	typedef double Scalar;
+	typedef double RealScalar;
+	typedef int StorageIndex;
+	enum {
+		ColsAtCompileTime = Eigen::Dynamic,
+		MaxColsAtCompileTime = Eigen::Dynamic,
+		IsRowMajor = false
+	};
+	
+	struct SpringJacobian
+	{
+		Eigen::Vector3d dx;
+		double a;
+		double b;
+		int d0; // starting DOF of the first particle, -1 if fixed
+		int d1; // starting DOF of the second particle, -1 if fixed
+	};
+	
+	ClothOperator();
+	virtual ~ClothOperator();
+	
+	// Sets the size of the system and the DOF indices of each spring. The
+	// springs are grouped into colors whose members share no particles.
+	void init(int n, const std::vector<int> &springDofs0, const std::vector<int> &springDofs1,
+			  const std::vector<int> &colorStart);
+	void setNumThreads(int nThreads) { this->nThreads = nThreads; }
+	
+	Eigen::Index rows() const { return n; }
+	Eigen::Index cols() const { return n; }
+	
+	template<typename Rhs>
+	Eigen::Product<ClothOperator, Rhs, Eigen::AliasFreeProduct> operator*(const Eigen::MatrixBase<Rhs> &x) const
+	{
+		return Eigen::Product<ClothOperator, Rhs, Eigen::AliasFreeProduct>(*this, x.derived());
+	}
+	
+	// Gathers the 3x3 diagonal blocks side by side into D (3 x n)
+	void getDiagonalBlocks(Eigen::Matrix3Xd &D) const;
+	
+	// y += alpha * (M - h^2 K) * x
+	void addProduct(const Eigen::Ref<const Eigen::VectorXd> &x, Eigen::Ref<Eigen::VectorXd> y, double alpha) const;
+	
+	Eigen::VectorXd diag;                // one entry per 3x3 diagonal block
+	std::vector<SpringJacobian> springs; // one entry per spring
+	
+private:
+	int n;
+	std::vector<int> colorStart;
+	int nThreads;
+};
+
+namespace Eigen {
+namespace internal {
+	template<typename Rhs>
+	struct generic_product_impl<ClothOperator, Rhs, SparseShape, DenseShape, GemvProduct> :
+		generic_product_impl_base< ClothOperator, Rhs, generic_product_impl<ClothOperator, Rhs> >
+	{
+		typedef typename Product<ClothOperator, Rhs>::Scalar Scalar;
+		
+		template<typename Dest>
+		static void scaleAndAddTo(Dest &dst, const ClothOperator &lhs, const Rhs &rhs, const Scalar &alpha)
+		{
+			lhs.addProduct(rhs, dst, alpha);
+		}
+	};
+}
+}
+
+#endif
@@ -0,0 +1,459 @@
+#pragma once
+#ifndef ClothPreconditioner_H
+#define ClothPreconditioner_H
+
+#include <vector>
+#include <memory>
+#include <algorithm>
+
+#define EIGEN_DONT_ALIGN_STATICALLY
+#include <Eigen/Dense>
+#include <Eigen/Sparse>
+
+#include "ClothOperator.h"
+
+/**
+ * Jacobi (BlockSize = 1) or per-particle block-Jacobi (BlockSize = 3)
+ * preconditioner for the cloth system, following Eigen's preconditioner
+ * concept so that it can be plugged into Eigen::ConjugateGradient.
+ * Works with both the assembled row-major system and the matrix-free
+ * ClothOperator (double only). Blocks are assumed to start at multiples of
+ * BlockSize.
+ */
+template<int BlockSize, typename _Scalar = double>
+class BlockJacobiPreconditioner
+{
+public:
+	typedef _Scalar Scalar;
+	typedef int StorageIndex;
+	enum {
+		ColsAtCompileTime = Eigen::Dynamic,
+		MaxColsAtCompileTime = Eigen::Dynamic
+	};
+	typedef Eigen::Matrix<Scalar, BlockSize, BlockSize> Block;
+	
+	BlockJacobiPreconditioner() {}
+	
+	Eigen::Index rows() const { return invBlocks.cols(); }
+	Eigen::Index cols() const { return invBlocks.cols(); }
+	
+	template<typename MatType>
+	BlockJacobiPreconditioner &analyzePattern(const MatType &) { return *this; }
+	template<typename MatType>
+	BlockJacobiPreconditioner &factorize(const MatType &mat) { return compute(mat); }
+	
+	BlockJacobiPreconditioner &compute(const Eigen::SparseMatrix<Scalar, Eigen::RowMajor> &A)
+	{
+		invBlocks.setZero(BlockSize, A.rows());
+		for(int row = 0; row < A.outerSize(); ++row) {
+			int start = row - row % BlockSize;
+			for(typename Eigen::SparseMatrix<Scalar, Eigen::RowMajor>::InnerIterator it(A, row); it; ++it) {
+				if(it.col() >= start && it.col() < start + BlockSize) {
+					invBlocks(row - start, it.col()) = it.value();
+				}
+			}
+		}
+		invert();
+		return *this;
+	}
+	
+	BlockJacobiPreconditioner &compute(const ClothOperator &op)
+	{
+		Eigen::Matrix3Xd D;
+		op.getDiagonalBlocks(D);
+		invBlocks.resize(BlockSize, D.cols());
+		for(int k = 0; k < (int)D.cols(); k += 3) {
+			for(int i = 0; i < 3; i += BlockSize) {
+				invBlocks.block(0, k+i, BlockSize, BlockSize) = D.block(i, k+i, BlockSize, BlockSize).template cast<Scalar>();
+			}
+		}
+		invert();
+		return *this;
+	}
+	
+	template<typename Rhs>
+	const Eigen::Solve<BlockJacobiPreconditioner, Rhs> solve(const Eigen::MatrixBase<Rhs> &b) const
+	{
+		return Eigen::Solve<BlockJacobiPreconditioner, Rhs>(*this, b.derived());
+	}
+	
+	template<typename Rhs, typename Dest>
+	void _solve_impl(const Rhs &b, Dest &x) const
+	{
+		x.resize(b.rows());
+		for(int k = 0; k < (int)b.rows(); k += BlockSize) {
+			x.template segment<BlockSize>(k) = invBlocks.template block<BlockSize, BlockSize>(0, k) * b.template segment<BlockSize>(k);
+		}
+	}
+	
+	Eigen::ComputationInfo info() { return Eigen::Success; }
+	
+private:
+	void invert()
+	{
+		for(int k = 0; k < (int)invBlocks.cols(); k += BlockSize) {
+			Block B = invBlocks.template block<BlockSize, BlockSize>(0, k);
+			Block Binv;
+			bool invertible;
+			B.computeInverseWithCheck(Binv, invertible);
+			invBlocks.template block<BlockSize, BlockSize>(0, k) = invertible ? Binv : Block::Identity();
+		}
+	}
+	
+	// Inverse of each diagonal block, stored side by side
+	Eigen::Matrix<Scalar, BlockSize, Eigen::Dynamic> invBlocks;
+};
+
+/**
+ * Geometric multigrid V-cycle for the system of a rows x cols grid cloth.
+ * Each coarser grid keeps every other row and column of the finer one (and
+ * always the last), and corrections are interpolated bilinearly. A coarse
+ * node is pinned if the fine particle it sits on is. The coarse systems are
+ * Galerkin products R A P with R = P^T, so spring, contact, and
+ * self-collision terms all carry over.
+ *
+ * Smoothing is damped block-Jacobi on the per-particle 3x3 blocks, which is
+ * parallel over particles. The cycle does the same number of sweeps before
+ * and after the coarse correction, so it is symmetric and can precondition
+ * CG. The coarsest grid is solved directly.
+ *
+ * Eigen::ConjugateGradient keeps its preconditioner by value, so copies share
+ * one hierarchy. Build it once with setGrid(); compute() only redoes the
+ * numeric part.
+ */
+template<typename _Scalar>
+class MultigridPreconditioner
+{
+public:
+	typedef _Scalar Scalar;
+	typedef int StorageIndex;
+	enum {
+		ColsAtCompileTime = Eigen::Dynamic,
+		MaxColsAtCompileTime = Eigen::Dynamic
+	};
+	typedef Eigen::Matrix<Scalar, Eigen::Dynamic, 1> Vector;
+	typedef Eigen::SparseMatrix<Scalar, Eigen::RowMajor> SpMat;
+	
+	// Stop coarsening at this many particles
+	static const int COARSEST_NODES = 64;
+	
+	MultigridPreconditioner() :
+		h(std::make_shared<Hierarchy>())
+	{
+	}
+	
+	// Builds the grid transfer operators. dofs are the starting DOF of each
+	// particle (i*cols + j), -1 if pinned, as in Cloth.
+	void setGrid(int rows, int cols, const std::vector<int> &dofs)
+	{
+		std::vector<Level> &levels = h->levels;
+		levels.clear();
+		std::vector<int> nodeDofs = dofs;
+		int n = 0;
+		for(int d : dofs) {
+			n = std::max(n, d + 3);
+		}
+		levels.push_back(Level());
+		levels.back().n = n;
+		while(rows*cols > COARSEST_NODES && (rows >= 3 || cols >= 3)) {
+			int rowsC = rows >= 3 ? rows/2 + 1 : rows;
+			int colsC = cols >= 3 ? cols/2 + 1 : cols;
+			std::vector<int> coarseDofs(rowsC*colsC, -1);
+			int nC = 0;
+			for(int I = 0; I < rowsC; ++I) {
+				for(int J = 0; J < colsC; ++J) {
+					int k = position(I, rows, rowsC)*cols + position(J, cols, colsC);
+					if(nodeDofs[k] >= 0) {
+						coarseDofs[I*colsC + J] = nC;
+						nC += 3;
+					}
+				}
+			}
+			if(nC == 0) {
+				break;
+			}
+			std::vector< Eigen::Triplet<Scalar> > trips;
+			for(int i = 0; i < rows; ++i) {
+				int I[2], J[2];
+				Scalar wi[2], wj[2];
+				int ni = interpolation(i, rows, rowsC, I, wi);
+				for(int j = 0; j < cols; ++j) {
+					int d = nodeDofs[i*cols + j];
+					if(d < 0) {
+						continue;
+					}
+					int nj = interpolation(j, cols, colsC, J, wj);
+					for(int a = 0; a < ni; ++a) {
+						for(int b = 0; b < nj; ++b) {
+							int D = coarseDofs[I[a]*colsC + J[b]];
+							if(D >= 0) {
+								for(int x = 0; x < 3; ++x) {
+									trips.push_back(Eigen::Triplet<Scalar>(d + x, D + x, wi[a]*wj[b]));
+								}
+							}
+						}
+					}
+				}
+			}
+			Level coarse;
+			coarse.n = nC;
+			coarse.P.resize(n, nC);
+			coarse.P.setFromTriplets(trips.begin(), trips.end());
+			coarse.R = coarse.P.transpose();
+			levels.push_back(coarse);
+			nodeDofs.swap(coarseDofs);
+			rows = rowsC;
+			cols = colsC;
+			n = nC;
+		}
+	}
+	
+	bool hasGrid() const { return !h->levels.empty(); }
+	int getNumLevels() const { return (int)h->levels.size(); }
+	void setNumThreads(int nThreads) { h->nThreads = nThreads; }
+	// Damping of the Jacobi sweeps and the number of sweeps on either side of
+	// the coarse correction
+	void setSmoothing(Scalar omega, int sweeps) { h->omega = omega; h->sweeps = sweeps; }
+	
+	Eigen::Index rows() const { return h->levels.empty() ? 0 : h->levels[0].n; }
+	Eigen::Index cols() const { return rows(); }
+	
+	template<typename MatType>
+	MultigridPreconditioner &analyzePattern(const MatType &) { return *this; }
+	template<typename MatType>
+	MultigridPreconditioner &factorize(const MatType &mat) { return compute(mat); }
+	
+	// The fine matrix is referenced, not copied, and must outlive the solve
+	template<typename MatType>
+	MultigridPreconditioner &compute(const MatType &A)
+	{
+		std::vector<Level> &levels = h->levels;
+		eigen_assert(!levels.empty() && A.rows() == levels[0].n && A.isCompressed());
+		levels[0].setMatrix(A.outerIndexPtr(), A.innerIndexPtr(), A.valuePtr());
+		for(int l = 1; l < (int)levels.size(); ++l) {
+			Level &L = levels[l];
+			if(L.A.nonZeros() == 0) {
+				// The pattern of A is fixed, so the general product is only
+				// needed once, for the pattern of R A P
+				if(l == 1) {
+					L.A = L.R*(A*L.P);
+				} else {
+					L.A = L.R*(levels[l-1].A*L.P);
+				}
+				L.A.makeCompressed();
+				L.setMatrix(L.A.outerIndexPtr(), L.A.innerIndexPtr(), L.A.valuePtr());
+			}
+			galerkin(levels[l-1], L);
+		}
+		for(int l = 0; l + 1 < (int)levels.size(); ++l) {
+			levels[l].invertDiagonal();
+		}
+		if(levels.size() == 1) {
+			h->coarsest.compute(A);
+		} else {
+			h->coarsest.compute(levels.back().A);
+		}
+		return *this;
+	}
+	
+	template<typename Rhs>
+	const Eigen::Solve<MultigridPreconditioner, Rhs> solve(const Eigen::MatrixBase<Rhs> &b) const
+	{
+		return Eigen::Solve<MultigridPreconditioner, Rhs>(*this, b.derived());
+	}
+	
+	template<typename Rhs, typename Dest>
+	void _solve_impl(const Rhs &b, Dest &x) const
+	{
+		Level &L = h->levels[0];
+		L.b = b;
+		vcycle(0);
+		x = L.x;
+	}
+	
+	Eigen::ComputationInfo info() { return h->coarsest.info(); }
+	
+private:
+	struct Level
+	{
+		Level() : n(0), outer(nullptr), inner(nullptr), values(nullptr) {}
+		
+		void setMatrix(const int *outer, const int *inner, const Scalar *values)
+		{
+			this->outer = outer;
+			this->inner = inner;
+			this->values = values;
+		}
+		
+		void invertDiagonal()
+		{
+			invDiag.resize(3, n);
+			for(int k = 0; k < n; k += 3) {
+				Eigen::Matrix<Scalar, 3, 3> B = Eigen::Matrix<Scalar, 3, 3>::Zero();
+				for(int i = 0; i < 3; ++i) {
+					for(int e = outer[k+i]; e < outer[k+i+1]; ++e) {
+						if(inner[e] >= k && inner[e] < k + 3) {
+							B(i, inner[e] - k) = values[e];
+						}
+					}
+				}
+				Eigen::Matrix<Scalar, 3, 3> Binv;
+				bool invertible;
+				// Blocks of light particles have tiny determinants, so only
+				// an exactly singular block is rejected
+				B.computeInverseWithCheck(Binv, invertible, Scalar(0));
+				invDiag.template block<3, 3>(0, k) = invertible ? Binv : Eigen::Matrix<Scalar, 3, 3>::Identity();
+			}
+		}
+		
+		// Row k of b - A x
+		Scalar residual(int k, const Vector &b, const Vector &x) const
+		{
+			Scalar r = b(k);
+			for(int e = outer[k]; e < outer[k+1]; ++e) {
+				r -= values[e]*x(inner[e]);
+			}
+			return r;
+		}
+		
+		int n;
+		SpMat A; // Galerkin system (coarse levels only)
+		SpMat P; // prolongation from this level to the next finer one
+		SpMat R; // restriction, P^T
+		const int *outer; // compressed rows of the system of this level
+		const int *inner;
+		const Scalar *values;
+		Eigen::Matrix<Scalar, 3, Eigen::Dynamic> invDiag; // inverse diagonal blocks, side by side
+		Vector b, x, r, tmp;
+	};
+	
+	struct Hierarchy
+	{
+		Hierarchy() : omega(0.8), sweeps(1), nThreads(1) {}
+		
+		std::vector<Level> levels;
+		Eigen::SimplicialLDLT<SpMat, Eigen::Lower, Eigen::AMDOrdering<int> > coarsest;
+		Scalar omega;
+		int sweeps;
+		int nThreads;
+	};
+	
+	// Fine index of coarse node I along an axis of nf fine and nc coarse nodes
+	static int position(int I, int nf, int nc)
+	{
+		return nc == nf ? I : std::min(2*I, nf - 1);
+	}
+	
+	// Coarse nodes (at most two) interpolating fine node i, and their weights
+	static int interpolation(int i, int nf, int nc, int *I, Scalar *w)
+	{
+		if(nc == nf || i % 2 == 0) {
+			I[0] = nc == nf ? i : i/2;
+			w[0] = 1;
+			return 1;
+		}
+		if(i == nf - 1) {
+			// Last node of an even axis, where the last coarse node sits
+			I[0] = nc - 1;
+			w[0] = 1;
+			return 1;
+		}
+		I[0] = i/2;
+		I[1] = i/2 + 1;
+		w[0] = w[1] = Scalar(0.5);
+		return 2;
+	}
+	
+	// Rewrites the values of C.A = R A P in its existing pattern, where A is
+	// the system of the finer level F. Each coarse row only gathers from the
+	// fine rows it restricts, so rows are independent.
+	void galerkin(const Level &F, Level &C) const
+	{
+		const int *Rout = C.R.outerIndexPtr();
+		const int *Rin = C.R.innerIndexPtr();
+		const Scalar *Rval = C.R.valuePtr();
+		const int *Pout = C.P.outerIndexPtr();
+		const int *Pin = C.P.innerIndexPtr();
+		const Scalar *Pval = C.P.valuePtr();
+		const int *Cout = C.A.outerIndexPtr();
+		const int *Cin = C.A.innerIndexPtr();
+		Scalar *Cval = C.A.valuePtr();
+		#pragma omp parallel num_threads(h->nThreads)
+		{
+			// Value index of each column of the current coarse row
+			std::vector<int> where(C.n, -1);
+			#pragma omp for schedule(static)
+			for(int I = 0; I < C.n; ++I) {
+				for(int e = Cout[I]; e < Cout[I+1]; ++e) {
+					where[Cin[e]] = e;
+					Cval[e] = 0;
+				}
+				for(int er = Rout[I]; er < Rout[I+1]; ++er) {
+					int i = Rin[er];
+					for(int ea = F.outer[i]; ea < F.outer[i+1]; ++ea) {
+						int j = F.inner[ea];
+						Scalar ra = Rval[er]*F.values[ea];
+						for(int ep = Pout[j]; ep < Pout[j+1]; ++ep) {
+							Cval[where[Pin[ep]]] += ra*Pval[ep];
+						}
+					}
+				}
+				for(int e = Cout[I]; e < Cout[I+1]; ++e) {
+					where[Cin[e]] = -1;
+				}
+			}
+		}
+	}
+	
+	void vcycle(int l) const
+	{
+		std::vector<Level> &levels = h->levels;
+		Level &L = levels[l];
+		if(l + 1 == (int)levels.size()) {
+			L.x = h->coarsest.solve(L.b);
+			return;
+		}
+		Level &C = levels[l+1];
+		L.x.resize(L.n);
+		L.tmp.resize(L.n);
+		L.r.resize(L.n);
+		smooth(L, true);
+		#pragma omp parallel for num_threads(h->nThreads)
+		for(int k = 0; k < L.n; ++k) {
+			L.r(k) = L.residual(k, L.b, L.x);
+		}
+		C.b = C.R*L.r;
+		vcycle(l + 1);
+		L.x += C.P*C.x;
+		smooth(L, false);
+	}
+	
+	// Damped block-Jacobi sweeps on L.x, the first one from zero before the
+	// coarse correction
+	void smooth(Level &L, bool pre) const
+	{
+		const Scalar omega = h->omega;
+		for(int s = 0; s < h->sweeps; ++s) {
+			if(pre && s == 0) {
+				#pragma omp parallel for num_threads(h->nThreads)
+				for(int k = 0; k < L.n; k += 3) {
+					L.x.template segment<3>(k) = omega*(L.invDiag.template block<3, 3>(0, k)*L.b.template segment<3>(k));
+				}
+				continue;
+			}
+			#pragma omp parallel for num_threads(h->nThreads)
+			for(int k = 0; k < L.n; k += 3) {
+				Eigen::Matrix<Scalar, 3, 1> r;
+				for(int i = 0; i < 3; ++i) {
+					r(i) = L.residual(k + i, L.b, L.x);
+				}
+				L.tmp.template segment<3>(k) = L.x.template segment<3>(k) + omega*(L.invDiag.template block<3, 3>(0, k)*r);
+			}
+			L.x.swap(L.tmp);
+		}
+	}
+	
+	std::shared_ptr<Hierarchy> h;
+};
+
+#endif
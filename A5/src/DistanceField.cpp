@@ -0,0 +1,302 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <cmath>
+#include <cfloat>
+#include <cstring>
+#include <map>
+#include <array>
+#include <algorithm>
+
+#include "DistanceField.h"
+#include "BVH.h"
+#include "Profiler.h"
+
+using namespace std;
+using namespace Eigen;
+
+static const uint32_t VERSION = 1;
+// Samples that were never within the band
+static const float UNKNOWN = FLT_MAX;
+
+struct DistanceFieldHeader
+{
+	char magic[4]; // "A5DF"
+	uint32_t version;
+	uint64_t hash;
+	double cellSize;
+	double band;
+	uint32_t nBricks;
+	uint32_t brick;
+};
+
+static int floorDiv(int a, int b)
+{
+	return a >= 0 ? a/b : -((-a + b - 1)/b);
+}
+
+DistanceField::DistanceField() :
+	cellSize(1.0),
+	band(0.0)
+{
+}
+
+DistanceField::~DistanceField()
+{
+}
+
+DistanceField::Key DistanceField::brickKey(const Vector3i &b) const
+{
+	// 21 bits per axis
+	const int offset = 1 << 20;
+	return ((Key)(b(0) + offset) << 42) | ((Key)(b(1) + offset) << 21) | (Key)(b(2) + offset);
+}
+
+float *DistanceField::brick(const Vector3i &b)
+{
+	auto it = bricks.find(brickKey(b));
+	if(it != bricks.end()) {
+		return &samples[(size_t)it->second*SAMPLES];
+	}
+	int index = (int)brickCoords.size();
+	bricks[brickKey(b)] = index;
+	brickCoords.push_back(b);
+	samples.resize(samples.size() + SAMPLES, UNKNOWN);
+	return &samples[(size_t)index*SAMPLES];
+}
+
+void DistanceField::build(const vector<float> &posBuf, double cellSize, double band)
+{
+	PROFILE_SCOPE("DistanceField::build");
+	this->cellSize = cellSize;
+	this->band = band;
+	bricks.clear();
+	brickCoords.clear();
+	samples.clear();
+
+	// Weld the soup into an indexed mesh so that neighboring triangles share
+	// their edges and vertices
+	vector<Vector3d> verts;
+	vector<Vector3i> tris;
+	map<array<float, 3>, int> vertIndex;
+	for(size_t k = 0; k + 9 <= posBuf.size(); k += 9) {
+		Vector3i t;
+		for(int i = 0; i < 3; ++i) {
+			array<float, 3> p = {{posBuf[k+3*i], posBuf[k+3*i+1], posBuf[k+3*i+2]}};
+			auto it = vertIndex.insert(make_pair(p, (int)verts.size())).first;
+			if(it->second == (int)verts.size()) {
+				verts.push_back(Vector3d(p[0], p[1], p[2]));
+			}
+			t(i) = it->second;
+		}
+		tris.push_back(t);
+	}
+
+	// Angle-weighted pseudonormals of the faces, edges, and vertices. The
+	// normal of edge i of a triangle is that of the edge opposite vertex i.
+	int nTris = (int)tris.size();
+	vector<Vector3d> faceNor(nTris);
+	vector<Vector3d> vertNor(verts.size(), Vector3d::Zero());
+	map<pair<int, int>, Vector3d> edgeSum;
+	for(int f = 0; f < nTris; ++f) {
+		const Vector3i &t = tris[f];
+		faceNor[f] = (verts[t(1)] - verts[t(0)]).cross(verts[t(2)] - verts[t(0)]).normalized();
+		for(int i = 0; i < 3; ++i) {
+			int a = t(i);
+			int b = t((i+1)%3);
+			int c = t((i+2)%3);
+			double angle = acos(max(-1.0, min(1.0, (verts[b] - verts[a]).normalized().dot((verts[c] - verts[a]).normalized()))));
+			vertNor[a] += angle*faceNor[f];
+			edgeSum[make_pair(min(b, c), max(b, c))] += faceNor[f];
+		}
+	}
+	vector<Vector3d> edgeNor(3*nTris);
+	for(int f = 0; f < nTris; ++f) {
+		const Vector3i &t = tris[f];
+		for(int i = 0; i < 3; ++i) {
+			int b = t((i+1)%3);
+			int c = t((i+2)%3);
+			edgeNor[3*f+i] = edgeSum[make_pair(min(b, c), max(b, c))];
+		}
+	}
+
+	// Every grid node within band of a triangle takes the smaller distance.
+	// A node on a brick face, edge, or corner is shared by up to 8 bricks.
+	for(int f = 0; f < nTris; ++f) {
+		const Vector3d &a = verts[tris[f](0)];
+		const Vector3d &b = verts[tris[f](1)];
+		const Vector3d &c = verts[tris[f](2)];
+		Vector3d lo = (a.cwiseMin(b).cwiseMin(c).array() - band)/cellSize;
+		Vector3d hi = (a.cwiseMax(b).cwiseMax(c).array() + band)/cellSize;
+		Vector3i nlo((int)ceil(lo(0)), (int)ceil(lo(1)), (int)ceil(lo(2)));
+		Vector3i nhi((int)floor(hi(0)), (int)floor(hi(1)), (int)floor(hi(2)));
+		for(int nz = nlo(2); nz <= nhi(2); ++nz) {
+			for(int ny = nlo(1); ny <= nhi(1); ++ny) {
+				for(int nx = nlo(0); nx <= nhi(0); ++nx) {
+					Vector3i n(nx, ny, nz);
+					Vector3d p = n.cast<double>()*cellSize;
+					Vector3d w = closestPointTriangle(p, a, b, c);
+					Vector3d q = w(0)*a + w(1)*b + w(2)*c;
+					double dist = (p - q).norm();
+					if(dist >= band) {
+						continue;
+					}
+					// Pseudonormal of the closest feature
+					int zeros = (w(0) == 0.0) + (w(1) == 0.0) + (w(2) == 0.0);
+					Vector3d nor = faceNor[f];
+					for(int i = 0; i < 3; ++i) {
+						if(zeros == 2 && w(i) == 1.0) {
+							nor = vertNor[tris[f](i)];
+						} else if(zeros == 1 && w(i) == 0.0) {
+							nor = edgeNor[3*f+i];
+						}
+					}
+					float d = (float)((p - q).dot(nor) < 0.0 ? -dist : dist);
+
+					Vector3i b0(floorDiv(nx, BRICK), floorDiv(ny, BRICK), floorDiv(nz, BRICK));
+					Vector3i shared;
+					for(int i = 0; i < 3; ++i) {
+						shared(i) = n(i) == b0(i)*BRICK;
+					}
+					for(int dz = 0; dz <= shared(2); ++dz) {
+						for(int dy = 0; dy <= shared(1); ++dy) {
+							for(int dx = 0; dx <= shared(0); ++dx) {
+								Vector3i bk = b0 - Vector3i(dx, dy, dz);
+								Vector3i l = n - bk*BRICK;
+								float &s = brick(bk)[l(0) + SIDE*(l(1) + SIDE*l(2))];
+								if(fabs(d) < fabs(s)) {
+									s = d;
+								}
+							}
+						}
+					}
+				}
+			}
+		}
+	}
+}
+
+uint64_t DistanceField::hashMesh(const vector<float> &posBuf, double cellSize, double band)
+{
+	// FNV-1a over the vertices, the parameters, and the format
+	uint64_t hash = 14695981039346656037ull;
+	auto add = [&hash](const void *data, size_t size) {
+		const unsigned char *bytes = (const unsigned char *)data;
+		for(size_t i = 0; i < size; ++i) {
+			hash = (hash ^ bytes[i])*1099511628211ull;
+		}
+	};
+	int brick = BRICK;
+	add(posBuf.data(), posBuf.size()*sizeof(float));
+	add(&cellSize, sizeof(cellSize));
+	add(&band, sizeof(band));
+	add(&VERSION, sizeof(VERSION));
+	add(&brick, sizeof(brick));
+	return hash;
+}
+
+void DistanceField::buildCached(const vector<float> &posBuf, double cellSize, double band, const string &cachePrefix)
+{
+	uint64_t hash = hashMesh(posBuf, cellSize, band);
+	ostringstream filename;
+	filename << cachePrefix << "." << hex << setw(16) << setfill('0') << hash << ".sdf";
+	if(load(filename.str(), hash)) {
+		return;
+	}
+	build(posBuf, cellSize, band);
+	save(filename.str(), hash);
+}
+
+bool DistanceField::save(const string &filename, uint64_t hash) const
+{
+	ofstream out(filename, ios::binary);
+	if(!out.good()) {
+		cerr << "Cannot write to " << filename << endl;
+		return false;
+	}
+	DistanceFieldHeader header;
+	memcpy(header.magic, "A5DF", 4);
+	header.version = VERSION;
+	header.hash = hash;
+	header.cellSize = cellSize;
+	header.band = band;
+	header.nBricks = (uint32_t)brickCoords.size();
+	header.brick = BRICK;
+	out.write((const char *)&header, sizeof(header));
+	for(const Vector3i &b : brickCoords) {
+		out.write((const char *)b.data(), 3*sizeof(int));
+	}
+	out.write((const char *)samples.data(), samples.size()*sizeof(float));
+	return out.good();
+}
+
+bool DistanceField::load(const string &filename, uint64_t hash)
+{
+	ifstream in(filename, ios::binary);
+	if(!in.good()) {
+		return false;
+	}
+	DistanceFieldHeader header;
+	in.read((char *)&header, sizeof(header));
+	if(!in.good() || memcmp(header.magic, "A5DF", 4) != 0 || header.version != VERSION || header.hash != hash || header.brick != BRICK) {
+		cerr << filename << " is stale or not a distance field, rebuilding" << endl;
+		return false;
+	}
+	vector<Vector3i> coords(header.nBricks);
+	vector<float> values((size_t)header.nBricks*SAMPLES);
+	for(Vector3i &b : coords) {
+		in.read((char *)b.data(), 3*sizeof(int));
+	}
+	in.read((char *)values.data(), values.size()*sizeof(float));
+	if(!in.good()) {
+		cerr << filename << " is truncated, rebuilding" << endl;
+		return false;
+	}
+	cellSize = header.cellSize;
+	band = header.band;
+	brickCoords.swap(coords);
+	samples.swap(values);
+	bricks.clear();
+	for(int k = 0; k < (int)brickCoords.size(); ++k) {
+		bricks[brickKey(brickCoords[k])] = k;
+	}
+	return true;
+}
+
+bool DistanceField::eval(const Vector3d &x, double &d, Vector3d &grad) const
+{
+	Vector3d g = x/cellSize;
+	Vector3i cell((int)floor(g(0)), (int)floor(g(1)), (int)floor(g(2)));
+	Vector3i b(floorDiv(cell(0), BRICK), floorDiv(cell(1), BRICK), floorDiv(cell(2), BRICK));
+	auto it = bricks.find(brickKey(b));
+	if(it == bricks.end()) {
+		return false;
+	}
+	Vector3i l = cell - b*BRICK;
+	const float *s = &samples[(size_t)it->second*SAMPLES + l(0) + SIDE*(l(1) + SIDE*l(2))];
+	double c[8];
+	for(int k = 0; k < 8; ++k) {
+		float v = s[(k & 1) + SIDE*(((k >> 1) & 1) + SIDE*(k >> 2))];
+		if(v == UNKNOWN) {
+			return false;
+		}
+		c[k] = v;
+	}
+	// Trilinear interpolation and its derivative
+	Vector3d t = g - cell.cast<double>();
+	double x00 = c[0] + t(0)*(c[1] - c[0]);
+	double x10 = c[2] + t(0)*(c[3] - c[2]);
+	double x01 = c[4] + t(0)*(c[5] - c[4]);
+	double x11 = c[6] + t(0)*(c[7] - c[6]);
+	double y0 = x00 + t(1)*(x10 - x00);
+	double y1 = x01 + t(1)*(x11 - x01);
+	d = y0 + t(2)*(y1 - y0);
+	double dx0 = (1 - t(1))*(c[1] - c[0]) + t(1)*(c[3] - c[2]);
+	double dx1 = (1 - t(1))*(c[5] - c[4]) + t(1)*(c[7] - c[6]);
+	grad(0) = (1 - t(2))*dx0 + t(2)*dx1;
+	grad(1) = (1 - t(2))*(x10 - x00) + t(2)*(x11 - x01);
+	grad(2) = y1 - y0;
+	grad /= cellSize;
+	return true;
+}
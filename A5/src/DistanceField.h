@@ -0,0 +1,70 @@
+#pragma once
+#ifndef DistanceField_H
+#define DistanceField_H
+
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <cstdint>
+
+#define EIGEN_DONT_ALIGN_STATICALLY
+#include <Eigen/Dense>
+
+/**
+ * Sparse narrow-band signed distance field of a closed triangle mesh, for
+ * static colliders. The field is sampled on a uniform grid, but only bricks
+ * of BRICK^3 cells near the surface are stored, in a hash map keyed by brick
+ * coordinates. Each brick keeps all (BRICK+1)^3 corner samples of its cells,
+ * so every cell lies in exactly one brick and a lookup is one hash probe and
+ * a trilinear interpolation, regardless of the size of the mesh.
+ *
+ * Samples farther than the band from the surface are not computed; lookups
+ * in cells that touch one report that the point is outside the band. Points
+ * deeper than the band therefore get no contact; Cloth catches particles
+ * that cross the band in one step by walking their path (with continuous
+ * collision on), so the band only has to be wider than a few cells. The
+ * sign comes from angle-weighted pseudonormals (Baerentzen and Aanaes 2005),
+ * so the mesh must be closed and consistently oriented.
+ */
+class DistanceField
+{
+public:
+	static constexpr int BRICK = 8;
+
+	DistanceField();
+	virtual ~DistanceField();
+
+	// Samples the field of a triangle soup (3 vertices per triangle, as in
+	// Shape) on a grid of the given spacing, within band of the surface
+	void build(const std::vector<float> &posBuf, double cellSize, double band);
+	// Loads the field cached in <cachePrefix>.<hash>.sdf, where the hash is
+	// that of the mesh and the parameters, or builds and caches it
+	void buildCached(const std::vector<float> &posBuf, double cellSize, double band, const std::string &cachePrefix);
+	bool save(const std::string &filename, uint64_t hash) const;
+	bool load(const std::string &filename, uint64_t hash);
+	static uint64_t hashMesh(const std::vector<float> &posBuf, double cellSize, double band);
+
+	// Signed distance at x (negative inside) and its gradient. Returns false
+	// if x is not within the band.
+	bool eval(const Eigen::Vector3d &x, double &d, Eigen::Vector3d &grad) const;
+
+	double getCellSize() const { return cellSize; }
+	double getBand() const { return band; }
+	int getNumBricks() const { return (int)brickCoords.size(); }
+
+private:
+	typedef int64_t Key;
+	static constexpr int SIDE = BRICK + 1;         // samples per brick side
+	static constexpr int SAMPLES = SIDE*SIDE*SIDE; // samples per brick
+
+	Key brickKey(const Eigen::Vector3i &b) const;
+	float *brick(const Eigen::Vector3i &b); // allocates on first use
+
+	double cellSize;
+	double band;
+	std::unordered_map<Key, int> bricks;     // brick -> index into brickCoords
+	std::vector<Eigen::Vector3i> brickCoords;
+	std::vector<float> samples;              // SAMPLES per brick, x fastest
+};
+
+#endif
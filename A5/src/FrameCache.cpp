@@ -0,0 +1,276 @@
+#include <iostream>
+#include <cassert>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+
+#include "FrameCache.h"
+
+using namespace std;
+using namespace Eigen;
+
+static const uint32_t VERSION = 1;
+
+// IEEE 754 half precision, rounding to nearest even
+static uint16_t floatToHalf(float f)
+{
+	uint32_t x;
+	memcpy(&x, &f, 4);
+	uint32_t sign = (x >> 16) & 0x8000;
+	uint32_t e = (x >> 23) & 0xff;
+	uint32_t mant = x & 0x7fffff;
+	if(e == 0xff) {
+		return (uint16_t)(sign | 0x7c00 | (mant ? 0x200 : 0)); // inf or nan
+	}
+	int exp = (int)e - 127 + 15;
+	if(exp >= 31) {
+		return (uint16_t)(sign | 0x7c00); // overflow to inf
+	}
+	if(exp <= 0) {
+		// Subnormal half, or zero
+		if(exp < -10) {
+			return (uint16_t)sign;
+		}
+		mant |= 0x800000;
+		int shift = 14 - exp;
+		uint32_t h = mant >> shift;
+		uint32_t rem = mant & ((1u << shift) - 1);
+		uint32_t halfway = 1u << (shift - 1);
+		if(rem > halfway || (rem == halfway && (h & 1))) {
+			++h;
+		}
+		return (uint16_t)(sign | h);
+	}
+	uint32_t h = ((uint32_t)exp << 10) | (mant >> 13);
+	uint32_t rem = mant & 0x1fff;
+	if(rem > 0x1000 || (rem == 0x1000 && (h & 1))) {
+		++h; // a carry into the exponent is still correct
+	}
+	return (uint16_t)(sign | h);
+}
+
+static float halfToFloat(uint16_t h)
+{
+	uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+	uint32_t exp = (h >> 10) & 0x1f;
+	uint32_t mant = h & 0x3ff;
+	uint32_t x;
+	if(exp == 0) {
+		if(mant == 0) {
+			x = sign;
+		} else {
+			// Normalize the subnormal
+			exp = 127 - 15 + 1;
+			while(!(mant & 0x400)) {
+				mant <<= 1;
+				--exp;
+			}
+			x = sign | (exp << 23) | ((mant & 0x3ff) << 13);
+		}
+	} else if(exp == 31) {
+		x = sign | 0x7f800000 | (mant << 13);
+	} else {
+		x = sign | ((exp + 127 - 15) << 23) | (mant << 13);
+	}
+	float f;
+	memcpy(&f, &x, 4);
+	return f;
+}
+
+size_t FrameCache::frameBytes(Encoding encoding, int nParticles)
+{
+	switch(encoding) {
+		case FLOAT16:
+			return 3*nParticles*sizeof(uint16_t);
+		case QUANTIZED_DELTA:
+			return 6*sizeof(float) + 3*nParticles*sizeof(uint16_t);
+		case FLOAT32:
+		default:
+			return 3*nParticles*sizeof(float);
+	}
+}
+
+FrameCacheWriter::FrameCacheWriter()
+{
+	memset(&header, 0, sizeof(header));
+}
+
+FrameCacheWriter::~FrameCacheWriter()
+{
+	close();
+}
+
+bool FrameCacheWriter::open(const string &filename, int nParticles, FrameCache::Encoding encoding)
+{
+	close();
+	out.open(filename, ios::binary | ios::trunc);
+	if(!out.good()) {
+		cerr << "Cannot write to " << filename << endl;
+		return false;
+	}
+	memcpy(header.magic, "A5FC", 4);
+	header.version = VERSION;
+	header.encoding = encoding;
+	header.nParticles = nParticles;
+	header.nFrames = 0;
+	header.frameBytes = (uint32_t)FrameCache::frameBytes(encoding, nParticles);
+	out.write((const char *)&header, sizeof(header));
+	record.resize(header.frameBytes);
+	ref.resize(3, 0);
+	return true;
+}
+
+void FrameCacheWriter::write(const Matrix3Xd &x)
+{
+	if(!out.is_open()) {
+		return;
+	}
+	assert(x.cols() == (int)header.nParticles);
+	int nParticles = (int)header.nParticles;
+	char *dst = &record[0];
+	switch(header.encoding) {
+		case FrameCache::FLOAT32: {
+			Matrix3Xf xf = x.cast<float>();
+			memcpy(dst, xf.data(), record.size());
+			break;
+		}
+		case FrameCache::FLOAT16: {
+			uint16_t *q = (uint16_t *)dst;
+			for(int k = 0; k < 3*nParticles; ++k) {
+				q[k] = floatToHalf((float)x.data()[k]);
+			}
+			break;
+		}
+		case FrameCache::QUANTIZED_DELTA: {
+			if(ref.cols() == 0) {
+				// The first frame is the reference, stored ahead of all frames
+				ref = x.cast<float>();
+				out.write((const char *)ref.data(), ref.size()*sizeof(float));
+			}
+			Matrix3Xf d = x.cast<float>() - ref;
+			Vector3f lo = d.rowwise().minCoeff();
+			Vector3f scale = (d.rowwise().maxCoeff() - lo)/65535.0f;
+			float *bounds = (float *)dst;
+			uint16_t *q = (uint16_t *)(dst + 6*sizeof(float));
+			for(int i = 0; i < 3; ++i) {
+				bounds[i] = lo(i);
+				bounds[3+i] = scale(i);
+			}
+			for(int k = 0; k < nParticles; ++k) {
+				for(int i = 0; i < 3; ++i) {
+					float t = scale(i) > 0.0f ? (d(i,k) - lo(i))/scale(i) : 0.0f;
+					q[3*k+i] = (uint16_t)min(max(lround(t), 0L), 65535L);
+				}
+			}
+			break;
+		}
+	}
+	out.write(dst, record.size());
+	++header.nFrames;
+}
+
+void FrameCacheWriter::close()
+{
+	if(!out.is_open()) {
+		return;
+	}
+	out.seekp(0);
+	out.write((const char *)&header, sizeof(header));
+	out.close();
+}
+
+FrameCacheReader::FrameCacheReader() :
+	data(nullptr),
+	frames(nullptr),
+	ref(nullptr)
+{
+	memset(&header, 0, sizeof(header));
+}
+
+FrameCacheReader::~FrameCacheReader()
+{
+	close();
+}
+
+bool FrameCacheReader::open(const string &filename)
+{
+	close();
+	if(!file.open(filename)) {
+		return false;
+	}
+	data = file.getData();
+	size_t size = file.getSize();
+
+	// Validate the header and the size before trusting any offsets
+	bool valid = size >= sizeof(FrameCache::Header);
+	if(valid) {
+		memcpy(&header, data, sizeof(header));
+		valid = memcmp(header.magic, "A5FC", 4) == 0 && header.version == VERSION && header.encoding <= FrameCache::QUANTIZED_DELTA;
+	}
+	valid = valid && header.frameBytes > 0 && header.frameBytes == FrameCache::frameBytes((FrameCache::Encoding)header.encoding, header.nParticles);
+	size_t offset = sizeof(FrameCache::Header);
+	size_t refBytes = 3*(size_t)header.nParticles*sizeof(float);
+	if(valid && header.encoding == FrameCache::QUANTIZED_DELTA) {
+		// Every frame is decoded against the reference positions, so a file
+		// cut off inside them has no usable frames
+		valid = size >= offset + refBytes;
+		ref = (const float *)(data + offset);
+		offset += refBytes;
+	}
+	if(valid) {
+		// The header is only patched when the writer is closed, so count the
+		// complete records instead. An interrupted bake then still plays back
+		// up to its last whole frame.
+		header.nFrames = (uint32_t)((size - offset)/header.frameBytes);
+	}
+	if(!valid) {
+		cerr << filename << " is not a valid frame cache" << endl;
+		close();
+		return false;
+	}
+	frames = data + offset;
+	return true;
+}
+
+void FrameCacheReader::close()
+{
+	file.close();
+	data = nullptr;
+	frames = nullptr;
+	ref = nullptr;
+	memset(&header, 0, sizeof(header));
+}
+
+void FrameCacheReader::read(int k, Matrix3Xd &x) const
+{
+	assert(data && k >= 0 && k < (int)header.nFrames);
+	int nParticles = (int)header.nParticles;
+	const char *src = frames + (size_t)k*header.frameBytes;
+	x.resize(3, nParticles);
+	switch(header.encoding) {
+		case FrameCache::FLOAT32: {
+			const float *p = (const float *)src;
+			for(int j = 0; j < 3*nParticles; ++j) {
+				x.data()[j] = p[j];
+			}
+			break;
+		}
+		case FrameCache::FLOAT16: {
+			const uint16_t *q = (const uint16_t *)src;
+			for(int j = 0; j < 3*nParticles; ++j) {
+				x.data()[j] = halfToFloat(q[j]);
+			}
+			break;
+		}
+		case FrameCache::QUANTIZED_DELTA: {
+			const float *bounds = (const float *)src;
+			const uint16_t *q = (const uint16_t *)(src + 6*sizeof(float));
+			for(int j = 0; j < nParticles; ++j) {
+				for(int i = 0; i < 3; ++i) {
+					x(i,j) = ref[3*j+i] + bounds[i] + q[3*j+i]*bounds[3+i];
+				}
+			}
+			break;
+		}
+	}
+}
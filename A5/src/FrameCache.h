@@ -0,0 +1,98 @@
+#pragma once
+#ifndef FrameCache_H
+#define FrameCache_H
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#define EIGEN_DONT_ALIGN_STATICALLY
+#include <Eigen/Dense>
+
+#include "MappedFile.h"
+
+/**
+ * Binary cache of baked particle positions, one record per frame. Every
+ * record of a file has the same size, so a frame is found by offset
+ * arithmetic and reading it is O(1) regardless of where it is.
+ *
+ * File layout (little endian):
+ *    Header
+ *    float32 reference positions (3 per particle), QUANTIZED_DELTA only
+ *    frame records
+ *
+ * Frame records by encoding:
+ *    FLOAT32          3 float32 per particle
+ *    FLOAT16          3 IEEE half floats per particle
+ *    QUANTIZED_DELTA  float32 offset[3] and scale[3] of this frame, then 3
+ *                     uint16 per particle: x = ref + offset + q*scale
+ */
+class FrameCache
+{
+public:
+	enum Encoding
+	{
+		FLOAT32,
+		FLOAT16,
+		QUANTIZED_DELTA // 16 bits per component, relative to the first frame
+	};
+
+	struct Header
+	{
+		char magic[4];  // "A5FC"
+		uint32_t version;
+		uint32_t encoding;
+		uint32_t nParticles;
+		uint32_t nFrames;
+		uint32_t frameBytes;
+	};
+
+	static size_t frameBytes(Encoding encoding, int nParticles);
+};
+
+// Streams frames to a cache file. The frame count in the header is patched
+// when the writer is closed, but readers count the records in the file, so a
+// bake that is killed before then is still readable.
+class FrameCacheWriter
+{
+public:
+	FrameCacheWriter();
+	virtual ~FrameCacheWriter();
+
+	bool open(const std::string &filename, int nParticles, FrameCache::Encoding encoding);
+	void write(const Eigen::Matrix3Xd &x);
+	void close();
+	bool isOpen() const { return out.is_open(); }
+	int getNumFrames() const { return (int)header.nFrames; }
+
+private:
+	std::ofstream out;
+	FrameCache::Header header;
+	Eigen::Matrix3Xf ref;
+	std::vector<char> record;
+};
+
+// Memory-maps a cache file for playback
+class FrameCacheReader
+{
+public:
+	FrameCacheReader();
+	virtual ~FrameCacheReader();
+
+	bool open(const std::string &filename);
+	void close();
+	int getNumFrames() const { return data ? (int)header.nFrames : 0; }
+	int getNumParticles() const { return data ? (int)header.nParticles : 0; }
+	// Decodes frame k into x (3 x particles)
+	void read(int k, Eigen::Matrix3Xd &x) const;
+
+private:
+	MappedFile file;
+	FrameCache::Header header;
+	const char *data;   // start of the mapping
+	const char *frames; // first frame record
+	const float *ref;
+};
+
+#endif
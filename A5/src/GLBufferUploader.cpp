@@ -0,0 +1,170 @@
+#include <iostream>
+#include <cassert>
+
+#include "GLBufferUploader.h"
+#include "GLSL.h"
+
+using namespace std;
+
+// Joins the strips separated by RESTART_INDEX into one strip. Repeating the
+// last index of a strip and the first of the next makes degenerate triangles,
+// and one more repeat when needed keeps every strip starting on an even
+// index so that its winding is unchanged.
+static vector<unsigned int> stitchStrips(const vector<unsigned int> &elements)
+{
+	vector<unsigned int> out;
+	size_t begin = 0;
+	while(begin < elements.size()) {
+		size_t end = begin;
+		while(end < elements.size() && elements[end] != BufferUploader::RESTART_INDEX) {
+			++end;
+		}
+		if(end > begin) {
+			if(!out.empty()) {
+				out.push_back(out.back());
+				out.push_back(elements[begin]);
+				if(out.size() % 2 == 1) {
+					out.push_back(elements[begin]);
+				}
+			}
+			out.insert(out.end(), elements.begin() + begin, elements.begin() + end);
+		}
+		begin = end + 1;
+	}
+	return out;
+}
+
+GLBufferUploader::GLBufferUploader() :
+	nVerts(0),
+	nElements(0),
+	primitive(TRIANGLES),
+	restart(false),
+	vertBufID(0),
+	eleBufID(0),
+	mapped(nullptr),
+	region(RING_SIZE - 1)
+{
+	for(int i = 0; i < RING_SIZE; ++i) {
+		fences[i] = nullptr;
+	}
+}
+
+GLBufferUploader::~GLBufferUploader()
+{
+	release();
+}
+
+// Deletes everything init() and draw() created. Needs the context current.
+void GLBufferUploader::release()
+{
+	for(int i = 0; i < RING_SIZE; ++i) {
+		if(fences[i]) {
+			glDeleteSync(fences[i]);
+			fences[i] = nullptr;
+		}
+	}
+	if(mapped) {
+		glBindBuffer(GL_ARRAY_BUFFER, vertBufID);
+		glUnmapBuffer(GL_ARRAY_BUFFER);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		mapped = nullptr;
+	}
+	if(vertBufID) {
+		glDeleteBuffers(1, &vertBufID);
+		vertBufID = 0;
+	}
+	if(eleBufID) {
+		glDeleteBuffers(1, &eleBufID);
+		eleBufID = 0;
+	}
+	staging.clear();
+	region = RING_SIZE - 1;
+}
+
+void GLBufferUploader::init(int nVerts, const vector<unsigned int> &elements, Primitive primitive)
+{
+	release();
+	this->nVerts = nVerts;
+	this->primitive = primitive;
+
+	// Static indices
+	restart = GLEW_VERSION_3_1 != 0;
+	const vector<unsigned int> &indices = restart || primitive != TRIANGLE_STRIP ? elements : stitchStrips(elements);
+	nElements = (int)indices.size();
+	glGenBuffers(1, &eleBufID);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, eleBufID);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size()*sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+	// Vertex ring
+	GLsizeiptr ringBytes = (GLsizeiptr)RING_SIZE*nVerts*VERTEX_BYTES;
+	glGenBuffers(1, &vertBufID);
+	glBindBuffer(GL_ARRAY_BUFFER, vertBufID);
+	if(GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage) {
+		GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glBufferStorage(GL_ARRAY_BUFFER, ringBytes, nullptr, flags);
+		mapped = (float *)glMapBufferRange(GL_ARRAY_BUFFER, 0, ringBytes, flags);
+	}
+	if(!mapped) {
+		glBufferData(GL_ARRAY_BUFFER, ringBytes, nullptr, GL_DYNAMIC_DRAW);
+		staging.resize(FLOATS_PER_VERTEX*nVerts);
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	assert(glGetError() == GL_NO_ERROR);
+}
+
+void GLBufferUploader::upload(const float *pos, const float *nor)
+{
+	region = (region + 1) % RING_SIZE;
+	if(mapped) {
+		// Wait until the GPU is done with the last draw from this region
+		if(fences[region]) {
+			GLenum status;
+			do {
+				status = glClientWaitSync(fences[region], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+			} while(status == GL_TIMEOUT_EXPIRED);
+			glDeleteSync(fences[region]);
+			fences[region] = nullptr;
+		}
+		interleave(mapped + (size_t)region*FLOATS_PER_VERTEX*nVerts, pos, nor, nVerts);
+	} else {
+		interleave(&staging[0], pos, nor, nVerts);
+		glBindBuffer(GL_ARRAY_BUFFER, vertBufID);
+		glBufferSubData(GL_ARRAY_BUFFER, (GLintptr)region*nVerts*VERTEX_BYTES, nVerts*VERTEX_BYTES, &staging[0]);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+}
+
+void GLBufferUploader::draw(int posAttrib, int norAttrib)
+{
+	size_t offset = (size_t)region*nVerts*VERTEX_BYTES;
+	glBindBuffer(GL_ARRAY_BUFFER, vertBufID);
+	glEnableVertexAttribArray(posAttrib);
+	glVertexAttribPointer(posAttrib, 3, GL_FLOAT, GL_FALSE, VERTEX_BYTES, (const void *)offset);
+	glEnableVertexAttribArray(norAttrib);
+	glVertexAttribPointer(norAttrib, 3, GL_FLOAT, GL_FALSE, VERTEX_BYTES, (const void *)(offset + 3*sizeof(float)));
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, eleBufID);
+	if(primitive == TRIANGLE_STRIP) {
+		if(restart) {
+			glEnable(GL_PRIMITIVE_RESTART);
+			glPrimitiveRestartIndex(RESTART_INDEX);
+		}
+		glDrawElements(GL_TRIANGLE_STRIP, nElements, GL_UNSIGNED_INT, (const void *)0);
+		if(restart) {
+			glDisable(GL_PRIMITIVE_RESTART);
+		}
+	} else {
+		glDrawElements(GL_TRIANGLES, nElements, GL_UNSIGNED_INT, (const void *)0);
+	}
+	if(mapped) {
+		if(fences[region]) {
+			glDeleteSync(fences[region]);
+		}
+		fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	}
+	glDisableVertexAttribArray(norAttrib);
+	glDisableVertexAttribArray(posAttrib);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+}
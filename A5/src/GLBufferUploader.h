@@ -0,0 +1,53 @@
+#pragma once
+#ifndef GLBufferUploader_H
+#define GLBufferUploader_H
+
+#include "BufferUploader.h"
+
+typedef struct __GLsync *GLsync;
+
+/**
+ * Uploads into a ring of RING_SIZE vertex regions in one buffer, so that the
+ * CPU writes one region while the GPU may still be reading the others. With
+ * GL 4.4 (or ARB_buffer_storage) the buffer is mapped once, persistently and
+ * coherently, and a frame is written straight into it; a fence per region
+ * keeps the CPU from overwriting a region the GPU has not finished drawing.
+ * Without it, each frame goes to its region with glBufferSubData, which still
+ * never reallocates the storage.
+ *
+ * Strips separated by RESTART_INDEX are drawn with primitive restart (GL 3.1),
+ * or, on older contexts, joined into one strip with degenerate triangles.
+ *
+ * The buffers and fences are deleted by the destructor, so it must run while
+ * the GL context is still current.
+ */
+class GLBufferUploader : public BufferUploader
+{
+public:
+	static constexpr int RING_SIZE = 3;
+
+	GLBufferUploader();
+	virtual ~GLBufferUploader();
+
+	void init(int nVerts, const std::vector<unsigned int> &elements, Primitive primitive);
+	void upload(const float *pos, const float *nor);
+	void draw(int posAttrib, int norAttrib);
+
+	bool isPersistent() const { return mapped != nullptr; }
+
+private:
+	void release();
+
+	int nVerts;
+	int nElements;
+	Primitive primitive;
+	bool restart;
+	unsigned vertBufID;
+	unsigned eleBufID;
+	float *mapped;              // persistent mapping of the whole ring, if supported
+	std::vector<float> staging; // interleaved frame for glBufferSubData
+	int region;                 // region of the latest upload
+	GLsync fences[RING_SIZE];
+};
+
+#endif
@@ -0,0 +1,93 @@
+#include <iostream>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "MappedFile.h"
+
+using namespace std;
+
+MappedFile::MappedFile() :
+	data(nullptr),
+	size(0)
+#ifdef _WIN32
+	, file(nullptr),
+	mapping(nullptr)
+#endif
+{
+}
+
+MappedFile::~MappedFile()
+{
+	close();
+}
+
+bool MappedFile::open(const string &filename)
+{
+	close();
+#ifdef _WIN32
+	HANDLE f = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if(f == INVALID_HANDLE_VALUE) {
+		cerr << "Cannot open " << filename << endl;
+		return false;
+	}
+	LARGE_INTEGER fileSize;
+	GetFileSizeEx(f, &fileSize);
+	HANDLE m = CreateFileMappingA(f, NULL, PAGE_READONLY, 0, 0, NULL);
+	void *p = m ? MapViewOfFile(m, FILE_MAP_READ, 0, 0, 0) : NULL;
+	if(!p) {
+		cerr << "Cannot map " << filename << endl;
+		if(m) {
+			CloseHandle(m);
+		}
+		CloseHandle(f);
+		return false;
+	}
+	file = f;
+	mapping = m;
+	size = (size_t)fileSize.QuadPart;
+#else
+	int fd = ::open(filename.c_str(), O_RDONLY);
+	if(fd < 0) {
+		cerr << "Cannot open " << filename << endl;
+		return false;
+	}
+	struct stat st;
+	fstat(fd, &st);
+	size = (size_t)st.st_size;
+	void *p = size > 0 ? mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+	::close(fd); // the mapping keeps the file alive
+	if(p == MAP_FAILED) {
+		cerr << "Cannot map " << filename << endl;
+		size = 0;
+		return false;
+	}
+#endif
+	data = (const char *)p;
+	return true;
+}
+
+void MappedFile::close()
+{
+	if(!data) {
+		return;
+	}
+#ifdef _WIN32
+	UnmapViewOfFile(data);
+	CloseHandle((HANDLE)mapping);
+	CloseHandle((HANDLE)file);
+	file = nullptr;
+	mapping = nullptr;
+#else
+	munmap((void *)data, size);
+#endif
+	data = nullptr;
+	size = 0;
+}
@@ -0,0 +1,34 @@
+#pragma once
+#ifndef MappedFile_H
+#define MappedFile_H
+
+#include <cstddef>
+#include <string>
+
+// Read-only memory mapping of a whole file. The pages are loaded on first
+// access, so opening is cheap regardless of the file size.
+class MappedFile
+{
+public:
+	MappedFile();
+	virtual ~MappedFile();
+
+	bool open(const std::string &filename);
+	void close();
+	bool isOpen() const { return data != nullptr; }
+	const char *getData() const { return data; }
+	size_t getSize() const { return size; }
+
+private:
+	MappedFile(const MappedFile &);
+	MappedFile &operator=(const MappedFile &);
+
+	const char *data;
+	size_t size;
+#ifdef _WIN32
+	void *file;
+	void *mapping;
+#endif
+};
+
+#endif
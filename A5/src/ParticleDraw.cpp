@@ -0,0 +1,25 @@
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "Particle.h"
+#include "Shape.h"
+#include "Program.h"
+#include "MatrixStack.h"
+
+using namespace std;
+
+void Particle::draw(shared_ptr<MatrixStack> MV, const shared_ptr<Program> prog) const
+{
+	if(sphere) {
+		MV->pushMatrix();
+		MV->translate(x(0), x(1), x(2));
+		MV->scale(r);
+		glUniformMatrix4fv(prog->getUniform("MV"), 1, GL_FALSE, glm::value_ptr(MV->topMatrix()));
+		sphere->draw(prog);
+		MV->popMatrix();
+	}
+}
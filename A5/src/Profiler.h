@@ -0,0 +1,65 @@
+//
+//    Scoped timers and counters for the hot paths. Every thread records into
+//    its own fixed-size ring buffer, so recording never takes a lock. The
+//    events can be exported in the Chrome trace-event format and opened in
+//    chrome://tracing or Perfetto.
+//
+//    Recording is compiled in only with -DPROFILE (the PROFILE CMake
+//    option). Without it the macros below expand to nothing.
+//
+
+#pragma once
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <cstdint>
+#include <string>
+
+namespace Profiler
+{
+	// Events each thread keeps; older ones are overwritten
+	const int RING_SIZE = 1 << 16;
+
+	struct Event
+	{
+		const char *name; // must outlive the profiler, e.g. a string literal
+		int64_t begin;    // ns since the profiler started
+		int64_t end;      // ns; end < 0 marks a counter sample
+		double value;     // counter value
+	};
+
+	int64_t now();
+	void record(const char *name, int64_t begin, int64_t end);
+	void counter(const char *name, double value);
+
+	// Drops all recorded events
+	void clear();
+	// Writes the recorded events of every thread as Chrome trace-event JSON.
+	// Call it while no other thread is recording.
+	bool writeChromeTrace(const std::string &filename);
+
+	class ScopedTimer
+	{
+	public:
+		ScopedTimer(const char *name) : name(name), begin(now()) {}
+		~ScopedTimer() { record(name, begin, now()); }
+	private:
+		const char *name;
+		int64_t begin;
+	};
+}
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+
+#ifdef PROFILE
+#define PROFILE_SCOPE(name) Profiler::ScopedTimer PROFILE_CONCAT(profileScope, __LINE__)(name)
+#define PROFILE_COUNTER(name, value) Profiler::counter(name, value)
+#define PROFILE_WRITE(filename) Profiler::writeChromeTrace(filename)
+#else
+#define PROFILE_SCOPE(name) ((void)0)
+#define PROFILE_COUNTER(name, value) ((void)0)
+#define PROFILE_WRITE(filename) ((void)0)
+#endif
+
+#endif
@@ -1,10 +1,14 @@
 #include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <cassert>
 
 #include "Scene.h"
 #include "Particle.h"
 #include "Cloth.h"
 #include "Shape.h"
-#include "Program.h"
+#include "DistanceField.h"
+#include "Profiler.h"
 
 using namespace std;
 using namespace Eigen;
@@ -12,7 +16,17 @@ using namespace Eigen;
 Scene::Scene() :
 	t(0.0),
 	h(1e-2),
-	grav(0.0, 0.0, 0.0)
+	frameTime(1e-2),
+	maxSubsteps(1),
+	substeps(0),
+	adaptive(false),
+	hMin(1e-4),
+	hMax(1e-2),
+	maxError(1e-3),
+	maxStrain(5e-2),
+	maxPenetration(5e-3),
+	grav(0.0, 0.0, 0.0),
+	frame(0)
 {
 }
 
@@ -24,6 +38,10 @@ void Scene::load(const string &RESOURCE_DIR)
 {
 	// Units: meters, kilograms, seconds
 	h = 5e-3;
+	frameTime = h;
+	maxSubsteps = 16;
+	hMin = 1e-4;
+	hMax = 2e-2;
 	
 	grav << 0.0, -9.8, 0.0;
 	
@@ -35,7 +53,7 @@ void Scene::load(const string &RESOURCE_DIR)
 	Vector3d x01(0.25, 0.5, 0.0);
 	Vector3d x10(-0.25, 0.5, -0.5);
 	Vector3d x11(0.25, 0.5, -0.5);
-	cloth = make_shared<Cloth>(rows, cols, x00, x01, x10, x11, mass, stiffness);
+	cloths.push_back(make_shared<Cloth>(rows, cols, x00, x01, x10, x11, mass, stiffness));
 	
 	sphereShape = make_shared<Shape>();
 	sphereShape->loadMesh(RESOURCE_DIR + "sphere2.obj");
@@ -46,10 +64,27 @@ void Scene::load(const string &RESOURCE_DIR)
 	sphere->x = Vector3d(0.0, 0.2, 0.0);
 }
 
-void Scene::init()
+void Scene::addCloth(shared_ptr<Cloth> cloth)
 {
-	sphereShape->init();
-	cloth->init();
+	cloth->setColliders(colliders);
+	cloths.push_back(cloth);
+}
+
+void Scene::addCollider(const string &meshName, double cellSize, double band)
+{
+	// Cloth finds particles that tunnel past the band by walking their path
+	// one cell at a time, so the band has to hold a whole cell even where
+	// the corners of a cell reach past it (a cell diagonal, sqrt(3) cells)
+	assert(band >= 3.0*cellSize);
+	auto shape = make_shared<Shape>();
+	shape->loadMesh(meshName);
+	auto collider = make_shared<DistanceField>();
+	collider->buildCached(shape->getPosBuf(), cellSize, band, meshName);
+	colliderShapes.push_back(shape);
+	colliders.push_back(collider);
+	for(int i = 0; i < (int)cloths.size(); ++i) {
+		cloths[i]->setColliders(colliders);
+	}
 }
 
 void Scene::tare()
@@ -57,38 +92,169 @@ void Scene::tare()
 	for(int i = 0; i < (int)spheres.size(); ++i) {
 		spheres[i]->tare();
 	}
-	cloth->tare();
+	for(int i = 0; i < (int)cloths.size(); ++i) {
+		cloths[i]->tare();
+	}
 }
 
 void Scene::reset()
 {
 	t = 0.0;
+	frame = 0;
 	for(int i = 0; i < (int)spheres.size(); ++i) {
 		spheres[i]->reset();
 	}
-	cloth->reset();
+	for(int i = 0; i < (int)cloths.size(); ++i) {
+		cloths[i]->reset();
+	}
 }
 
 void Scene::step()
 {
-	t += h;
+	PROFILE_SCOPE("Scene::step");
+	if(isPlaying()) {
+		setFrame((frame + 1) % getNumFrames());
+		return;
+	}
 	
-	// Move the sphere
+	// Split the frame into the fewest substeps of at most h, capped at
+	// maxSubsteps. With a fixed h equal to the frame time this is one step.
+	double remaining = frameTime;
+	substeps = 0;
+	while(remaining > 0.0 && substeps < maxSubsteps) {
+		int n = (int)ceil(remaining/h - 1e-9);
+		n = max(1, min(n, maxSubsteps - substeps));
+		double hs = remaining/n;
+		substep(hs);
+		remaining = n == 1 ? 0.0 : remaining - hs;
+		++substeps;
+		if(adaptive) {
+			adaptTimeStep(hs);
+		}
+	}
+	for(int i = 0; i < (int)bakers.size(); ++i) {
+		bakers[i]->write(cloths[i]->getPositions());
+	}
+}
+
+bool Scene::startBake(const string &prefix, FrameCache::Encoding encoding)
+{
+	stopBake();
+	for(int i = 0; i < (int)cloths.size(); ++i) {
+		auto baker = make_shared<FrameCacheWriter>();
+		if(!baker->open(prefix + to_string(i) + ".cache", cloths[i]->getNumParticles(), encoding)) {
+			stopBake();
+			return false;
+		}
+		bakers.push_back(baker);
+	}
+	return true;
+}
+
+void Scene::stopBake()
+{
+	bakers.clear(); // the writers finish their files when destroyed
+}
+
+bool Scene::startPlayback(const string &prefix)
+{
+	stopPlayback();
+	for(int i = 0; i < (int)cloths.size(); ++i) {
+		auto player = make_shared<FrameCacheReader>();
+		if(!player->open(prefix + to_string(i) + ".cache") || player->getNumParticles() != cloths[i]->getNumParticles()) {
+			cerr << "No matching cache for cloth " << i << endl;
+			stopPlayback();
+			return false;
+		}
+		players.push_back(player);
+	}
+	if(getNumFrames() == 0) {
+		stopPlayback();
+		return false;
+	}
+	setFrame(0);
+	return true;
+}
+
+void Scene::stopPlayback()
+{
+	players.clear();
+}
+
+int Scene::getNumFrames() const
+{
+	int nFrames = players.empty() ? 0 : players.front()->getNumFrames();
+	for(int i = 1; i < (int)players.size(); ++i) {
+		nFrames = min(nFrames, players[i]->getNumFrames());
+	}
+	return nFrames;
+}
+
+void Scene::setFrame(int k)
+{
+	if(!isPlaying()) {
+		return;
+	}
+	assert(k >= 0 && k < getNumFrames());
+	frame = k;
+	// Baked frame k was written after k+1 steps
+	t = (k + 1)*frameTime;
+	moveSpheres(0.0);
+	for(int i = 0; i < (int)players.size(); ++i) {
+		players[i]->read(k, framePos);
+		cloths[i]->setPositions(framePos);
+	}
+}
+
+void Scene::adaptTimeStep(double hs)
+{
+	// Each criterion gives the largest step it allows for the next substep
+	double hNext = 2.0*h;
+	for(int i = 0; i < (int)cloths.size(); ++i) {
+		const Cloth &cloth = *cloths[i];
+		if(cloth.getError() > maxError) {
+			// CG ran out of iterations: the system is too stiff for this step
+			hNext = min(hNext, 0.5*hs);
+		}
+		double rate = cloth.getMaxStrainRate();
+		if(rate > 0.0) {
+			hNext = min(hNext, 0.9*maxStrain/rate);
+		}
+		double depth = cloth.getMaxPenetration();
+		if(depth > maxPenetration) {
+			hNext = min(hNext, hs*maxPenetration/depth);
+		}
+	}
+	h = max(hMin, min(hNext, hMax));
+}
+
+// Moves the spheres to time t. With h > 0 this ends a step of length h, and
+// the velocity is set to the motion over it, for continuous collisions.
+void Scene::moveSpheres(double h)
+{
 	if(!spheres.empty()) {
 		auto s = spheres.front();
 		Vector3d x0 = s->x;
 		s->x(2) = 0.5 * sin(0.5*t);
+		if(h > 0.0) {
+			s->v = (s->x - x0)/h;
+		}
 	}
-	
-	// Simulate the cloth
-	cloth->step(h, grav, spheres);
 }
 
-void Scene::draw(shared_ptr<MatrixStack> MV, const shared_ptr<Program> prog) const
+void Scene::substep(double h)
 {
-	glUniform3fv(prog->getUniform("kdFront"), 1, Vector3f(1.0, 1.0, 1.0).data());
-	for(int i = 0; i < (int)spheres.size(); ++i) {
-		spheres[i]->draw(MV, prog);
+	t += h;
+	
+	// Move the sphere
+	moveSpheres(h);
+	
+	// Simulate the cloths. With several of them, each thread steps whole
+	// cloths and the cloths' own parallel loops run serially inside; a single
+	// cloth keeps all threads for its own loops.
+	int nCloths = (int)cloths.size();
+	#pragma omp parallel for schedule(dynamic) if(nCloths > 1)
+	for(int i = 0; i < nCloths; ++i) {
+		cloths[i]->step(h, grav, spheres);
 	}
-	cloth->draw(MV, prog);
 }
@@ -9,11 +9,14 @@
 #define EIGEN_DONT_ALIGN_STATICALLY
 #include <Eigen/Dense>
 
+#include "FrameCache.h"
+
 class Cloth;
 class Particle;
 class MatrixStack;
 class Program;
 class Shape;
+class DistanceField;
 
 class Scene
 {
@@ -32,15 +35,72 @@ public:
 	void draw(std::shared_ptr<MatrixStack> MV, const std::shared_ptr<Program> prog) const;
 	
 	double getTime() const { return t; }
+	// Fixed time step; each call to step() then advances exactly one step
+	void setTimeStep(double h) { this->h = h; frameTime = h; }
+	double getTimeStep() const { return h; }
+	// Simulated time advanced by each call to step(), split into substeps
+	void setFrameTime(double frameTime) { this->frameTime = frameTime; }
+	double getFrameTime() const { return frameTime; }
+	void setMaxSubsteps(int maxSubsteps) { this->maxSubsteps = maxSubsteps; }
+	int getSubsteps() const { return substeps; }
+	// Adaptive time step: h is picked between hMin and hMax from the CG
+	// convergence, the spring strain rate, and the sphere penetration depth
+	void setAdaptive(bool adaptive) { this->adaptive = adaptive; }
+	void setTimeStepRange(double hMin, double hMax) { this->hMin = hMin; this->hMax = hMax; }
+	void setMaxSolverError(double maxError) { this->maxError = maxError; }
+	void setMaxStrain(double maxStrain) { this->maxStrain = maxStrain; }
+	void setMaxPenetration(double maxPenetration) { this->maxPenetration = maxPenetration; }
+	// The first cloth
+	std::shared_ptr<Cloth> getCloth() const { return cloths.front(); }
+	// Cloths share no particles and are stepped concurrently; the spheres are
+	// shared by all of them and only read while stepping
+	void addCloth(std::shared_ptr<Cloth> cloth);
+	const std::vector< std::shared_ptr<Cloth> > &getCloths() const { return cloths; }
+	// Static collider from a closed OBJ mesh. Its distance field is sampled
+	// every cellSize within band of the surface, and cached next to the mesh.
+	void addCollider(const std::string &meshName, double cellSize = 1e-2, double band = 4e-2);
+	
+	// Bake: every step() also appends the positions of cloth i to
+	// <prefix><i>.cache
+	bool startBake(const std::string &prefix, FrameCache::Encoding encoding = FrameCache::FLOAT32);
+	void stopBake();
+	bool isBaking() const { return !bakers.empty(); }
+	// Playback: step() shows the next baked frame instead of simulating, and
+	// setFrame() jumps to any frame
+	bool startPlayback(const std::string &prefix);
+	void stopPlayback();
+	bool isPlaying() const { return !players.empty(); }
+	void setFrame(int k);
+	int getFrame() const { return frame; }
+	int getNumFrames() const;
 	
 private:
+	void moveSpheres(double h);
+	void substep(double h);
+	void adaptTimeStep(double h);
+	
 	double t;
 	double h;
+	double frameTime;
+	int maxSubsteps;
+	int substeps;
+	bool adaptive;
+	double hMin;
+	double hMax;
+	double maxError;       // relative CG residual allowed at the end of a step
+	double maxStrain;      // strain allowed per step
+	double maxPenetration; // penetration allowed per step
 	Eigen::Vector3d grav;
 	
 	std::shared_ptr<Shape> sphereShape;
-	std::shared_ptr<Cloth> cloth;
+	std::vector< std::shared_ptr<Shape> > colliderShapes;
+	std::vector< std::shared_ptr<DistanceField> > colliders;
+	std::vector< std::shared_ptr<Cloth> > cloths;
+	std::vector< std::shared_ptr<FrameCacheWriter> > bakers;
+	std::vector< std::shared_ptr<FrameCacheReader> > players;
 	std::vector< std::shared_ptr<Particle> > spheres;
+	int frame;
+	Eigen::Matrix3Xd framePos; // decoded playback frame
 };
 
 #endif
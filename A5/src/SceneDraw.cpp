@@ -0,0 +1,38 @@
+#define GLM_FORCE_RADIANS
+#include <glm/gtc/type_ptr.hpp>
+
+#include "Scene.h"
+#include "Particle.h"
+#include "Cloth.h"
+#include "Shape.h"
+#include "MatrixStack.h"
+#include "Program.h"
+
+using namespace std;
+using namespace Eigen;
+
+void Scene::init()
+{
+	sphereShape->init();
+	for(int i = 0; i < (int)colliderShapes.size(); ++i) {
+		colliderShapes[i]->init();
+	}
+	for(int i = 0; i < (int)cloths.size(); ++i) {
+		cloths[i]->init();
+	}
+}
+
+void Scene::draw(shared_ptr<MatrixStack> MV, const shared_ptr<Program> prog) const
+{
+	glUniform3fv(prog->getUniform("kdFront"), 1, Vector3f(1.0, 1.0, 1.0).data());
+	for(int i = 0; i < (int)spheres.size(); ++i) {
+		spheres[i]->draw(MV, prog);
+	}
+	glUniformMatrix4fv(prog->getUniform("MV"), 1, GL_FALSE, glm::value_ptr(MV->topMatrix()));
+	for(int i = 0; i < (int)colliderShapes.size(); ++i) {
+		colliderShapes[i]->draw(prog);
+	}
+	for(int i = 0; i < (int)cloths.size(); ++i) {
+		cloths[i]->draw(MV, prog);
+	}
+}
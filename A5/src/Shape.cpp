@@ -1,9 +1,6 @@
 #include "Shape.h"
 #include <iostream>
 
-#include "GLSL.h"
-#include "Program.h"
-
 #define TINYOBJLOADER_IMPLEMENTATION
 #include "tiny_obj_loader.h"
 
@@ -65,72 +62,3 @@ void Shape::loadMesh(const string &meshName)
 		}
 	}
 }
-
-void Shape::init()
-{
-	// Send the position array to the GPU
-	glGenBuffers(1, &posBufID);
-	glBindBuffer(GL_ARRAY_BUFFER, posBufID);
-	glBufferData(GL_ARRAY_BUFFER, posBuf.size()*sizeof(float), &posBuf[0], GL_STATIC_DRAW);
-	
-	// Send the normal array to the GPU
-	if(!norBuf.empty()) {
-		glGenBuffers(1, &norBufID);
-		glBindBuffer(GL_ARRAY_BUFFER, norBufID);
-		glBufferData(GL_ARRAY_BUFFER, norBuf.size()*sizeof(float), &norBuf[0], GL_STATIC_DRAW);
-	}
-	
-	// Send the texture array to the GPU
-	if(!texBuf.empty()) {
-		glGenBuffers(1, &texBufID);
-		glBindBuffer(GL_ARRAY_BUFFER, texBufID);
-		glBufferData(GL_ARRAY_BUFFER, texBuf.size()*sizeof(float), &texBuf[0], GL_STATIC_DRAW);
-	}
-	
-	// Unbind the arrays
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-	
-	GLSL::checkError(GET_FILE_LINE);
-}
-
-void Shape::draw(const shared_ptr<Program> prog) const
-{
-	GLSL::checkError(GET_FILE_LINE);
-	// Bind position buffer
-	int h_pos = prog->getAttribute("aPos");
-	glEnableVertexAttribArray(h_pos);
-	glBindBuffer(GL_ARRAY_BUFFER, posBufID);
-	glVertexAttribPointer(h_pos, 3, GL_FLOAT, GL_FALSE, 0, (const void *)0);
-	
-	// Bind normal buffer
-	int h_nor = prog->getAttribute("aNor");
-	if(h_nor != -1 && norBufID != 0) {
-		glEnableVertexAttribArray(h_nor);
-		glBindBuffer(GL_ARRAY_BUFFER, norBufID);
-		glVertexAttribPointer(h_nor, 3, GL_FLOAT, GL_FALSE, 0, (const void *)0);
-	}
-	
-	// Bind texcoords buffer
-	int h_tex = prog->getAttribute("aTex");
-	if(h_tex != -1 && texBufID != 0) {
-		glEnableVertexAttribArray(h_tex);
-		glBindBuffer(GL_ARRAY_BUFFER, texBufID);
-		glVertexAttribPointer(h_tex, 2, GL_FLOAT, GL_FALSE, 0, (const void *)0);
-	}
-	
-	// Draw
-	int count = posBuf.size()/3; // number of indices to be rendered
-	glDrawArrays(GL_TRIANGLES, 0, count);
-	
-	// Disable and unbind
-	if(h_tex != -1) {
-		glDisableVertexAttribArray(h_tex);
-	}
-	if(h_nor != -1) {
-		glDisableVertexAttribArray(h_nor);
-	}
-	glDisableVertexAttribArray(h_pos);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-	
-	GLSL::checkError(GET_FILE_LINE);
-}
@@ -23,6 +23,7 @@ public:
 	void loadMesh(const std::string &meshName);
 	void init();
 	void draw(const std::shared_ptr<Program> prog) const;
+	const std::vector<float> &getPosBuf() const { return posBuf; }
 	
 private:
 	std::vector<float> posBuf;
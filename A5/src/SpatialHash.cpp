@@ -0,0 +1,107 @@
+#include <cmath>
+#include <algorithm>
+
+#include "SpatialHash.h"
+#include "Particle.h"
+#include "Profiler.h"
+
+using namespace std;
+using namespace Eigen;
+
+SpatialHash::SpatialHash() :
+	cellSize(0.0),
+	margin(0.0)
+{
+}
+
+SpatialHash::~SpatialHash()
+{
+}
+
+SpatialHash::Key SpatialHash::cellKey(int i, int j, int k) const
+{
+	// 21 bits per axis
+	const int offset = 1 << 20;
+	return ((Key)(i + offset) << 42) | ((Key)(j + offset) << 21) | (Key)(k + offset);
+}
+
+Vector3i SpatialHash::cellOf(const Vector3d &x) const
+{
+	return Vector3i((int)floor(x(0)/cellSize), (int)floor(x(1)/cellSize), (int)floor(x(2)/cellSize));
+}
+
+void SpatialHash::insert(int s)
+{
+	for(int i = lo[s](0); i <= hi[s](0); ++i) {
+		for(int j = lo[s](1); j <= hi[s](1); ++j) {
+			for(int k = lo[s](2); k <= hi[s](2); ++k) {
+				cells[cellKey(i, j, k)].push_back(s);
+			}
+		}
+	}
+}
+
+void SpatialHash::remove(int s)
+{
+	for(int i = lo[s](0); i <= hi[s](0); ++i) {
+		for(int j = lo[s](1); j <= hi[s](1); ++j) {
+			for(int k = lo[s](2); k <= hi[s](2); ++k) {
+				auto it = cells.find(cellKey(i, j, k));
+				if(it != cells.end()) {
+					vector<int> &cell = it->second;
+					cell.erase(std::remove(cell.begin(), cell.end(), s), cell.end());
+				}
+			}
+		}
+	}
+}
+
+void SpatialHash::update(const vector< shared_ptr<Particle> > &spheres, double margin, double h)
+{
+	PROFILE_SCOPE("SpatialHash::update");
+	double rmax = 0.0;
+	for(const auto &s : spheres) {
+		rmax = max(rmax, s->r);
+	}
+	double size = 2.0*(rmax + margin);
+	
+	// Start over if the number of spheres or the cell size changed
+	bool rebuild = (spheres.size() != lo.size() || size != cellSize || margin != this->margin);
+	if(rebuild) {
+		cells.clear();
+		cellSize = size;
+		this->margin = margin;
+		lo.resize(spheres.size());
+		hi.resize(spheres.size());
+	}
+	
+	for(int s = 0; s < (int)spheres.size(); ++s) {
+		Vector3d ext = Vector3d::Constant(spheres[s]->r + margin);
+		Vector3d x0 = spheres[s]->x - h*spheres[s]->v;
+		Vector3i l = cellOf(spheres[s]->x.cwiseMin(x0) - ext);
+		Vector3i u = cellOf(spheres[s]->x.cwiseMax(x0) + ext);
+		if(rebuild) {
+			lo[s] = l;
+			hi[s] = u;
+			insert(s);
+		} else if(l != lo[s] || u != hi[s]) {
+			remove(s);
+			lo[s] = l;
+			hi[s] = u;
+			insert(s);
+		}
+	}
+}
+
+const vector<int> *SpatialHash::query(const Vector3d &x) const
+{
+	if(cells.empty()) {
+		return nullptr;
+	}
+	Vector3i c = cellOf(x);
+	auto it = cells.find(cellKey(c(0), c(1), c(2)));
+	if(it == cells.end() || it->second.empty()) {
+		return nullptr;
+	}
+	return &it->second;
+}
@@ -0,0 +1,54 @@
+#pragma once
+#ifndef SpatialHash_H
+#define SpatialHash_H
+
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include <cstdint>
+
+#define EIGEN_DONT_ALIGN_STATICALLY
+#include <Eigen/Dense>
+
+class Particle;
+
+/**
+ * Uniform-grid broad phase for particle-sphere collisions.
+ * Each sphere is stored in every cell overlapped by its bounding box grown
+ * by the particle radius, so a particle only has to look at its own cell.
+ * The cell size is twice the largest sphere radius plus the margin. Updates
+ * are incremental: only spheres whose covered cells changed are re-inserted.
+ *
+ * There are two modes:
+ *  - Static (h = 0): the box is around the sphere's current position, so
+ *    each sphere covers at most 2x2x2 cells.
+ *  - Swept (h > 0): the box is around the sphere's whole path over the last
+ *    h, from x - h v to x, for continuous collision detection. The cell size
+ *    does not grow with the path, so a sphere that moves d along an axis
+ *    spans up to 2 + ceil(d/cellSize) cells along that axis.
+ */
+class SpatialHash
+{
+public:
+	SpatialHash();
+	virtual ~SpatialHash();
+	
+	void update(const std::vector< std::shared_ptr<Particle> > &spheres, double margin, double h = 0.0);
+	// Returns the spheres that may touch a particle at x, or null if there are none
+	const std::vector<int> *query(const Eigen::Vector3d &x) const;
+	
+private:
+	typedef int64_t Key;
+	Key cellKey(int i, int j, int k) const;
+	Eigen::Vector3i cellOf(const Eigen::Vector3d &x) const;
+	void insert(int s);
+	void remove(int s);
+	
+	double cellSize;
+	double margin;
+	std::vector<Eigen::Vector3i> lo; // covered cell range of each sphere
+	std::vector<Eigen::Vector3i> hi;
+	std::unordered_map< Key, std::vector<int> > cells;
+};
+
+#endif
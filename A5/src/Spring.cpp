@@ -1,25 +1,13 @@
-#include "Spring.h"
-#include "Particle.h"
+#include <cassert>
 
-using namespace std;
-using namespace Eigen;
+#include "Spring.h"
 
-Spring::Spring(shared_ptr<Particle> p0, shared_ptr<Particle> p1) :
-	E(1.0)
+Spring::Spring(int i0, int i1, double E, double L) :
+	i0(i0),
+	i1(i1),
+	E(E),
+	L(L)
 {
-	assert(p0);
-	assert(p1);
-	assert(p0 != p1);
-	this->p0 = p0;
-	this->p1 = p1;
-	Vector3d x0 = p0->x;
-	Vector3d x1 = p1->x;
-	Vector3d dx = x1 - x0;
-	L = dx.norm();
+	assert(i0 != i1);
 	assert(L > 0.0);
 }
-
-Spring::~Spring()
-{
-	
-}
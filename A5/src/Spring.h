@@ -2,18 +2,15 @@
 #ifndef Spring_H
 #define Spring_H
 
-#include <memory>
-
-class Particle;
-
+// A spring between two cloth particles, referenced by particle index so that
+// the cloth can keep its springs in one contiguous table.
 class Spring
 {
 public:
-	Spring(std::shared_ptr<Particle> p0, std::shared_ptr<Particle> p1);
-	virtual ~Spring();
+	Spring(int i0, int i1, double E, double L);
 	
-	std::shared_ptr<Particle> p0;
-	std::shared_ptr<Particle> p1;
+	int i0; // index of the first particle
+	int i1; // index of the second particle
 	double E;
 	double L;
 };
@@ -0,0 +1,70 @@
+#pragma once
+#ifndef TripleBuffer_H
+#define TripleBuffer_H
+
+#include <atomic>
+
+/**
+ * Lock-free triple buffer for handing whole frames from one producer thread
+ * to one consumer thread. The producer fills the back buffer and publishes
+ * it; the consumer picks up the most recently published buffer, if any.
+ * Neither side ever blocks, and the consumer never sees a partial frame.
+ */
+template<typename T>
+class TripleBuffer
+{
+public:
+	TripleBuffer() :
+		back(0),
+		middle(1),
+		front(2),
+		requested(true)
+	{
+	}
+	
+	// Sets all three buffers. Not thread-safe; call before sharing.
+	void reset(const T &value)
+	{
+		for(int i = 0; i < 3; ++i) {
+			buffers[i] = value;
+		}
+	}
+	
+	// Producer side
+	T &getBack() { return buffers[back]; }
+	void publish()
+	{
+		back = middle.exchange(back | FRESH, std::memory_order_acq_rel) & INDEX;
+	}
+	
+	// Consumer side: takes the latest published buffer, returns false if
+	// nothing new was published since the last call
+	bool update()
+	{
+		if(!(middle.load(std::memory_order_relaxed) & FRESH)) {
+			return false;
+		}
+		front = middle.exchange(front, std::memory_order_acq_rel) & INDEX;
+		return true;
+	}
+	const T &getFront() const { return buffers[front]; }
+	
+	// Lets a producer that only fills buffers on demand know that the
+	// consumer wants a new frame
+	void request() { requested.store(true, std::memory_order_release); }
+	bool takeRequest() { return requested.exchange(false, std::memory_order_acq_rel); }
+	
+private:
+	enum {
+		INDEX = 3, // low bits of middle: buffer index
+		FRESH = 4  // set when middle holds a frame the consumer has not taken
+	};
+	
+	T buffers[3];
+	int back;
+	std::atomic<int> middle;
+	int front;
+	std::atomic<bool> requested;
+};
+
+#endif
@@ -8,6 +8,9 @@
 #define _GLIBCXX_USE_NANOSLEEP
 #endif
 #include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
 
 #define GLEW_STATIC
 #include <GL/glew.h>
@@ -23,6 +26,8 @@
 #include "MatrixStack.h"
 #include "Shape.h"
 #include "Scene.h"
+#include "Cloth.h"
+#include "Profiler.h"
 
 using namespace std;
 using namespace Eigen;
@@ -31,12 +36,21 @@ bool keyToggles[256] = {false}; // only for English keyboards!
 
 GLFWwindow *window; // Main application window
 string RESOURCE_DIR = ""; // Where the resources are loaded from
+string COLLIDER_MESH = ""; // Optional closed OBJ mesh the cloth collides with
 
 shared_ptr<Camera> camera;
 shared_ptr<Program> prog;
 shared_ptr<Program> progSimple;
 shared_ptr<Scene> scene;
 
+// The stepper thread sleeps on this while the simulation is paused. It is
+// the only thread that modifies the scene: key commands that step, reset,
+// bake or play back are queued here and run by it between steps.
+mutex stepperMutex;
+condition_variable stepperCV;
+vector<unsigned int> stepperCommands;
+atomic<bool> stepperQuit(false);
+
 static void error_callback(int error, const char *description)
 {
 	cerr << description << endl;
@@ -51,7 +65,26 @@ static void key_callback(GLFWwindow *window, int key, int scancode, int action,
 
 static void char_callback(GLFWwindow *window, unsigned int key)
 {
+	lock_guard<mutex> lock(stepperMutex);
 	keyToggles[key] = !keyToggles[key];
+	switch(key) {
+		case ' ':
+			stepperCV.notify_one();
+			break;
+		case 'h':
+		case 'r':
+		case 'b':
+		case 'p':
+			// Anything that changes the scene runs on the stepper thread
+			stepperCommands.push_back(key);
+			stepperCV.notify_one();
+			break;
+	}
+}
+
+// Applies a queued key command. Called by the stepper thread between steps.
+static void runCommand(unsigned int key)
+{
 	switch(key) {
 		case 'h':
 			scene->step();
@@ -59,6 +92,23 @@ static void char_callback(GLFWwindow *window, unsigned int key)
 		case 'r':
 			scene->reset();
 			break;
+		case 'b':
+			// Bake the simulation to disk, or stop baking
+			if(scene->isBaking()) {
+				scene->stopBake();
+			} else {
+				scene->startBake(RESOURCE_DIR + "../bake");
+			}
+			break;
+		case 'p':
+			// Play the baked frames back instead of simulating
+			if(scene->isPlaying()) {
+				scene->stopPlayback();
+			} else {
+				scene->stopBake();
+				scene->startPlayback(RESOURCE_DIR + "../bake");
+			}
+			break;
 	}
 }
 
@@ -122,6 +172,12 @@ static void init()
 
 	scene = make_shared<Scene>();
 	scene->load(RESOURCE_DIR);
+	if(!COLLIDER_MESH.empty()) {
+		scene->addCollider(COLLIDER_MESH);
+	}
+	for(auto cloth : scene->getCloths()) {
+		cloth->setBuffersOnDemand(true);
+	}
 	scene->tare();
 	scene->init();
 	
@@ -133,6 +189,7 @@ static void init()
 
 void render()
 {
+	PROFILE_SCOPE("render");
 	// Get current frame buffer size.
 	int width, height;
 	glfwGetFramebufferSize(window, &width, &height);
@@ -227,11 +284,29 @@ void render()
 
 void stepperFunc()
 {
-	while(true) {
-		if(keyToggles[(unsigned)' ']) {
+	// Step flat out while running. Finished frames are handed to the renderer
+	// through the cloth's triple buffer, so no synchronization is needed here.
+	vector<unsigned int> commands;
+	while(!stepperQuit) {
+		bool running;
+		{
+			unique_lock<mutex> lock(stepperMutex);
+			stepperCV.wait(lock, [] {
+				return keyToggles[(unsigned)' '] || !stepperCommands.empty() || stepperQuit;
+			});
+			running = keyToggles[(unsigned)' '];
+			commands.swap(stepperCommands);
+		}
+		if(stepperQuit) {
+			break;
+		}
+		for(unsigned int key : commands) {
+			runCommand(key);
+		}
+		commands.clear();
+		if(running) {
 			scene->step();
 		}
-		this_thread::sleep_for(chrono::microseconds(1));
 	}
 }
 
@@ -242,6 +317,9 @@ int main(int argc, char **argv)
 		return 0;
 	}
 	RESOURCE_DIR = argv[1] + string("/");
+	if(argc > 2) {
+		COLLIDER_MESH = argv[2];
+	}
 	
 	// Set error callback.
 	glfwSetErrorCallback(error_callback);
@@ -290,7 +368,15 @@ int main(int argc, char **argv)
 		glfwPollEvents();
 	}
 	// Quit program.
-	stepperThread.detach();
+	{
+		lock_guard<mutex> lock(stepperMutex);
+		stepperQuit = true;
+	}
+	stepperCV.notify_one();
+	stepperThread.join();
+	PROFILE_WRITE("trace.json");
+	// Free the scene's GL objects while the context still exists
+	scene = nullptr;
 	glfwDestroyWindow(window);
 	glfwTerminate();
 	return 0;
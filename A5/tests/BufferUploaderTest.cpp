@@ -0,0 +1,86 @@
+// Drives a grid cloth's upload path with MockBufferUploader and checks what
+// would have been sent to the GPU.
+
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Cloth.h"
+#include "Particle.h"
+#include "BufferUploader.h"
+
+using namespace std;
+using namespace Eigen;
+
+static int failures = 0;
+
+static void check(bool ok, const string &what)
+{
+	if(!ok) {
+		cerr << "FAILED: " << what << endl;
+		++failures;
+	}
+}
+
+// True if the mock holds the cloth's positions, interleaved with normals
+static bool holdsPositions(const MockBufferUploader &mock, const Cloth &cloth)
+{
+	const vector<float> &v = mock.getVertices();
+	const Matrix3Xd &x = cloth.getPositions();
+	for(int k = 0; k < (int)x.cols(); ++k) {
+		for(int i = 0; i < 3; ++i) {
+			if(v[BufferUploader::FLOATS_PER_VERTEX*k + i] != (float)x(i,k)) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+int main()
+{
+	const int rows = 30;
+	const int cols = 30;
+	Cloth cloth(rows, cols,
+				Vector3d(-0.25, 0.5, 0.0), Vector3d(0.25, 0.5, 0.0),
+				Vector3d(-0.25, 0.5, -0.5), Vector3d(0.25, 0.5, -0.5),
+				0.1, 1e1);
+	auto mock = make_shared<MockBufferUploader>();
+	cloth.setUploader(mock);
+	cloth.initBuffers();
+	
+	// One strip per pair of rows, separated by restart indices, and the
+	// first frame uploaded right away
+	int nVerts = rows*cols;
+	int strips = rows - 1;
+	check(mock->getPrimitive() == BufferUploader::TRIANGLE_STRIP, "grid is drawn as strips");
+	check(mock->getRestarts() == strips - 1, "restart between strips");
+	check((int)mock->getElements().size() == strips*2*cols + strips - 1, "element count");
+	check(mock->getElementBytes() == mock->getElements().size()*sizeof(unsigned int), "elements uploaded once");
+	for(unsigned int e : mock->getElements()) {
+		check(e == BufferUploader::RESTART_INDEX || e < (unsigned int)nVerts, "element in range");
+	}
+	check(mock->getUploads() == 1, "initial frame uploaded");
+	check(holdsPositions(*mock, cloth), "initial frame holds the positions");
+	
+	// Each stepped frame is uploaded once, and only once
+	vector< shared_ptr<Particle> > spheres;
+	const int frames = 5;
+	for(int k = 0; k < frames; ++k) {
+		cloth.step(5e-3, Vector3d(0.0, -9.8, 0.0), spheres);
+		cloth.uploadFrame();
+		cloth.uploadFrame(); // nothing new published
+		mock->draw(0, 1);
+	}
+	check(mock->getUploads() == 1 + frames, "one upload per published frame");
+	check(mock->getDraws() == frames, "one draw per frame");
+	check(mock->getUploadBytes() == (size_t)(1 + frames)*nVerts*BufferUploader::VERTEX_BYTES, "upload bytes");
+	check(holdsPositions(*mock, cloth), "last frame holds the positions");
+	
+	if(failures > 0) {
+		return 1;
+	}
+	cout << "Passed: " << mock->getElements().size() << " indices, " << mock->getRestarts() << " restarts, " << mock->getUploadBytes() << " bytes uploaded" << endl;
+	return 0;
+}
@@ -0,0 +1,85 @@
+// Builds a cloth from a triangle fan whose center touches more springs than
+// fit in 64 colors, plus an unreferenced vertex and a degenerate face, and
+// checks the particles and the spring coloring.
+
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "Cloth.h"
+#include "Particle.h"
+
+using namespace std;
+using namespace Eigen;
+
+static int failures = 0;
+
+static void check(bool ok, const string &what)
+{
+	if(!ok) {
+		cerr << "FAILED: " << what << endl;
+		++failures;
+	}
+}
+
+int main()
+{
+	// Center vertex 1, rim vertices 2..N+1, then a vertex only used by a
+	// degenerate face and one that is not used at all
+	const int N = 100;
+	string filename = "ClothMeshTest.obj";
+	{
+		ofstream out(filename);
+		out << "v 0 0 0\n";
+		for(int i = 0; i < N; ++i) {
+			double a = 2.0*M_PI*i/N;
+			out << "v " << cos(a) << " " << sin(a) << " 0\n";
+		}
+		out << "v 2 0 0\nv 3 0 0\n";
+		for(int i = 0; i < N; ++i) {
+			out << "f 1 " << i + 2 << " " << (i + 1)%N + 2 << "\n";
+		}
+		out << "f " << N + 2 << " " << N + 2 << " 1\n";
+	}
+	
+	auto cloth = make_shared<Cloth>(filename, vector<int>(1, 1), 0.1, 1e1);
+	
+	// Only the fan's vertices become particles, and all of them have mass
+	check(cloth->getNumParticles() == N + 1, "one particle per referenced vertex");
+	const VectorXd &m = cloth->getMasses();
+	check(m.size() == N + 1 && m.minCoeff() > 0.0, "every particle has mass");
+	
+	// The center has a stretch spring to every rim vertex, so it needs more
+	// than 64 colors. Springs of a color must not share a particle.
+	const vector<Spring> &springs = cloth->getSprings();
+	const vector<int> &colorStart = cloth->getColorStart();
+	int nColors = (int)colorStart.size() - 1;
+	check(nColors > 64, "more than 64 colors (got " + to_string(nColors) + ")");
+	check(colorStart.front() == 0 && colorStart.back() == (int)springs.size(), "colors cover all springs");
+	for(int c = 0; c < nColors; ++c) {
+		check(colorStart[c] <= colorStart[c+1], "colors are sorted");
+		vector<bool> touched(cloth->getNumParticles(), false);
+		for(int s = colorStart[c]; s < colorStart[c+1]; ++s) {
+			bool shared = touched[springs[s].i0] || touched[springs[s].i1];
+			check(!shared, "color " + to_string(c) + " has springs sharing a particle");
+			touched[springs[s].i0] = true;
+			touched[springs[s].i1] = true;
+		}
+	}
+	
+	// The system is not singular, so the cloth can be stepped
+	vector< shared_ptr<Particle> > spheres;
+	for(int k = 0; k < 10; ++k) {
+		cloth->step(1e-2, Vector3d(0.0, -9.8, 0.0), spheres);
+	}
+	check(cloth->getPositions().allFinite(), "positions stay finite");
+	
+	if(failures > 0) {
+		return 1;
+	}
+	cout << "Passed: " << cloth->getNumParticles() << " particles, " << springs.size() << " springs, " << nColors << " colors" << endl;
+	return 0;
+}
@@ -0,0 +1,80 @@
+// Drops a cloth onto a box collider fast enough to cross the distance
+// field's whole band in one step, and checks that it stays on top.
+
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Cloth.h"
+#include "DistanceField.h"
+#include "Particle.h"
+
+using namespace std;
+using namespace Eigen;
+
+static int failures = 0;
+
+static void check(bool ok, const string &what)
+{
+	if(!ok) {
+		cerr << "FAILED: " << what << endl;
+		++failures;
+	}
+}
+
+// Triangle soup of the box [lo, hi], wound outward
+static vector<float> boxTriangles(const Vector3d &lo, const Vector3d &hi)
+{
+	const int faces[6][4] = {
+		{0, 4, 6, 2}, {1, 3, 7, 5}, // -x, +x
+		{0, 1, 5, 4}, {2, 6, 7, 3}, // -y, +y
+		{0, 2, 3, 1}, {4, 5, 7, 6}  // -z, +z
+	};
+	vector<float> posBuf;
+	auto corner = [&](int c) {
+		posBuf.push_back((float)(c & 1 ? hi(0) : lo(0)));
+		posBuf.push_back((float)(c & 2 ? hi(1) : lo(1)));
+		posBuf.push_back((float)(c & 4 ? hi(2) : lo(2)));
+	};
+	for(const auto &f : faces) {
+		corner(f[0]); corner(f[1]); corner(f[2]);
+		corner(f[0]); corner(f[2]); corner(f[3]);
+	}
+	return posBuf;
+}
+
+static double lowestParticle(bool ccd)
+{
+	auto collider = make_shared<DistanceField>();
+	collider->build(boxTriangles(Vector3d(-1.0, -1.0, -1.0), Vector3d(1.0, 0.0, 1.0)), 1e-2, 4e-2);
+	
+	// 10 cm above the top face, falling about 20 cm in the first step
+	Cloth cloth(5, 5,
+				Vector3d(-0.2, 0.1, 0.2), Vector3d(0.2, 0.1, 0.2),
+				Vector3d(-0.2, 0.1, -0.2), Vector3d(0.2, 0.1, -0.2),
+				0.1, 1e1);
+	cloth.setContinuousCollision(ccd);
+	cloth.setColliders(vector< shared_ptr<DistanceField> >(1, collider));
+	vector< shared_ptr<Particle> > spheres;
+	for(int k = 0; k < 5; ++k) {
+		cloth.step(2e-2, Vector3d(0.0, -500.0, 0.0), spheres);
+	}
+	return cloth.getPositions().row(1).minCoeff();
+}
+
+int main()
+{
+	// Without the check the cloth falls through the top face; with it, no
+	// particle ends deeper than the band
+	double without = lowestParticle(false);
+	double with = lowestParticle(true);
+	check(without < -4e-2, "cloth tunnels without continuous collision (lowest " + to_string(without) + ")");
+	check(with > -4e-2, "cloth stays on the box (lowest " + to_string(with) + ")");
+	
+	if(failures > 0) {
+		return 1;
+	}
+	cout << "Passed: lowest particle " << with << " with continuous collision, " << without << " without" << endl;
+	return 0;
+}
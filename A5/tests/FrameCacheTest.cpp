@@ -0,0 +1,98 @@
+// Writes frame caches in every encoding, reads them back, and checks that
+// interrupted and truncated files are handled.
+
+#include <cstddef>
+#include <cstring>
+#include <iostream>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "FrameCache.h"
+
+using namespace std;
+using namespace Eigen;
+
+static int failures = 0;
+
+static void check(bool ok, const string &what)
+{
+	if(!ok) {
+		cerr << "FAILED: " << what << endl;
+		++failures;
+	}
+}
+
+static vector<char> readFile(const string &filename)
+{
+	ifstream in(filename, ios::binary);
+	return vector<char>(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+}
+
+static void writeFile(const string &filename, const vector<char> &bytes, size_t size)
+{
+	ofstream out(filename, ios::binary | ios::trunc);
+	out.write(bytes.data(), size);
+}
+
+int main()
+{
+	const int nParticles = 10;
+	const int nFrames = 7;
+	const char *names[] = { "FLOAT32", "FLOAT16", "QUANTIZED_DELTA" };
+	for(int e = FrameCache::FLOAT32; e <= FrameCache::QUANTIZED_DELTA; ++e) {
+		FrameCache::Encoding encoding = (FrameCache::Encoding)e;
+		string name = names[e];
+		string filename = string("FrameCacheTest") + name + ".cache";
+		vector<Matrix3Xd> x;
+		{
+			FrameCacheWriter writer;
+			check(writer.open(filename, nParticles, encoding), name + ": open for writing");
+			for(int k = 0; k < nFrames; ++k) {
+				x.push_back(Matrix3Xd::Random(3, nParticles));
+				writer.write(x.back());
+			}
+		}
+		
+		// Round trip, within the precision of the encoding
+		double tol = encoding == FrameCache::FLOAT32 ? 1e-6 : 1e-3;
+		FrameCacheReader reader;
+		check(reader.open(filename), name + ": open");
+		check(reader.getNumFrames() == nFrames, name + ": frame count");
+		for(int k = 0; k < reader.getNumFrames(); ++k) {
+			Matrix3Xd y;
+			reader.read(k, y);
+			check((y - x[k]).cwiseAbs().maxCoeff() < tol, name + ": frame " + to_string(k));
+		}
+		reader.close();
+		
+		// A bake killed before close() has no frame count in its header and
+		// may end in a partial frame. The whole frames are still read.
+		vector<char> bytes = readFile(filename);
+		string cut = string("FrameCacheTest") + name + "Cut.cache";
+		FrameCache::Header header;
+		memcpy(&header, bytes.data(), sizeof(header));
+		header.nFrames = 0;
+		memcpy(bytes.data(), &header, sizeof(header));
+		writeFile(cut, bytes, bytes.size() - header.frameBytes/2);
+		check(reader.open(cut), name + ": open interrupted bake");
+		check(reader.getNumFrames() == nFrames - 1, name + ": whole frames of interrupted bake");
+		reader.close();
+		
+		// Cut off inside the header, or inside the reference positions that
+		// quantized frames are decoded against
+		writeFile(cut, bytes, sizeof(header) - 1);
+		check(!reader.open(cut), name + ": reject truncated header");
+		if(encoding == FrameCache::QUANTIZED_DELTA) {
+			writeFile(cut, bytes, sizeof(header) + 3*nParticles*sizeof(float) - 4);
+			check(!reader.open(cut), name + ": reject truncated reference");
+		}
+	}
+	
+	if(failures > 0) {
+		return 1;
+	}
+	cout << "Passed" << endl;
+	return 0;
+}
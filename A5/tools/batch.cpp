@@ -0,0 +1,87 @@
+// Headless batch driver: steps the A5 scene without a window or an OpenGL
+// context and writes the cloth particle state to disk.
+//
+// Usage: A5_batch RESOURCE_DIR STEPS [EVERY] [OUTPUT_PREFIX] [H]
+//    STEPS          number of steps to simulate
+//    EVERY          write the state every EVERY steps (default: only the last step)
+//    OUTPUT_PREFIX  output files are OUTPUT_PREFIX<step>.txt (default: "cloth")
+//    H              time step (default: the one set by Scene::load)
+//
+// Each output file has a header line "<step> <time> <particles>" followed by
+// one line per particle: "x y z vx vy vz".
+
+#include <climits>
+#include <cstdlib>
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <string>
+
+#include "Scene.h"
+#include "Cloth.h"
+#include "Profiler.h"
+
+using namespace std;
+using namespace Eigen;
+
+static bool writeState(const string &filename, int step, const shared_ptr<Scene> scene)
+{
+	ofstream out(filename);
+	if(!out.good()) {
+		cerr << "Cannot write to " << filename << endl;
+		return false;
+	}
+	auto cloth = scene->getCloth();
+	const Matrix3Xd &x = cloth->getPositions();
+	const Matrix3Xd &v = cloth->getVelocities();
+	out << setprecision(17);
+	out << step << " " << scene->getTime() << " " << x.cols() << "\n";
+	for(int k = 0; k < (int)x.cols(); ++k) {
+		out << x(0,k) << " " << x(1,k) << " " << x(2,k) << " ";
+		out << v(0,k) << " " << v(1,k) << " " << v(2,k) << "\n";
+	}
+	return out.good();
+}
+
+int main(int argc, char **argv)
+{
+	const char *usage = "Usage: A5_batch RESOURCE_DIR STEPS [EVERY] [OUTPUT_PREFIX] [H]";
+	if(argc < 3) {
+		cout << usage << endl;
+		return 0;
+	}
+	string RESOURCE_DIR = argv[1] + string("/");
+	int steps = atoi(argv[2]);
+	int every = steps;
+	if(argc > 3) {
+		// EVERY must be a positive integer, otherwise nothing would be written
+		char *end;
+		long val = strtol(argv[3], &end, 10);
+		if(end == argv[3] || *end != '\0' || val <= 0 || val > INT_MAX) {
+			cerr << "Invalid EVERY: " << argv[3] << endl;
+			cerr << usage << endl;
+			return -1;
+		}
+		every = (int)val;
+	}
+	string prefix = argc > 4 ? argv[4] : "cloth";
+	
+	auto scene = make_shared<Scene>();
+	scene->load(RESOURCE_DIR);
+	if(argc > 5) {
+		scene->setTimeStep(atof(argv[5]));
+	}
+	scene->tare();
+	
+	for(int k = 1; k <= steps; ++k) {
+		scene->step();
+		if(every > 0 && (k % every == 0 || k == steps)) {
+			if(!writeState(prefix + to_string(k) + ".txt", k, scene)) {
+				return -1;
+			}
+		}
+	}
+	PROFILE_WRITE(prefix + "trace.json");
+	cout << "Simulated " << steps << " steps to t = " << scene->getTime() << endl;
+	return 0;
+}
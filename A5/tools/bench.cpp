@@ -0,0 +1,201 @@
+// Cloth benchmark: steps a freshly built Cloth for every combination of grid
+// size, sphere count, and stiffness, and writes the per-phase timings of
+// Cloth::step as JSON (laid out like Google Benchmark's JSON reporter).
+//
+// Usage: A5_bench [STEPS] [MAX_GRID] [OUTPUT] [PRECOND] [SOLVER]
+//    STEPS     timed steps per configuration (default: 20)
+//    MAX_GRID  skip grids larger than MAX_GRID x MAX_GRID (default: 512)
+//    OUTPUT    JSON file to write (default: standard output, or "-")
+//    PRECOND   jacobi, block-jacobi, ic, or multigrid (default: jacobi)
+//    SOLVER    cg or chebyshev (default: cg)
+//
+// Grids go from 16 to 512 by powers of two, spheres from 1 to 1000 by powers
+// of ten, and stiffness from 1e1 to 1e4 by powers of ten. All times in the
+// output are milliseconds per step, except pattern_ms, which is the one-time
+// setup of the sparsity pattern in the constructor. solver_iterations counts
+// the operator applications of the solve itself; estimate_products counts the
+// ones Chebyshev spends on re-estimating its spectrum bounds.
+// unconverged_steps counts the steps whose solve stopped at the iteration
+// cap above the tolerance, so their iteration counts are only lower bounds.
+
+#include <chrono>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "Cloth.h"
+#include "Particle.h"
+
+using namespace std;
+using namespace Eigen;
+
+static const int WARMUP_STEPS = 2;
+
+struct Config
+{
+	int grid;
+	int spheres;
+	double stiffness;
+	Cloth::Preconditioner precond;
+	Cloth::Solver solver;
+};
+
+// Spheres scattered below the cloth, small enough that a thousand still fit
+static vector< shared_ptr<Particle> > createSpheres(int count)
+{
+	mt19937 rng(0);
+	uniform_real_distribution<double> ux(-0.25, 0.25);
+	uniform_real_distribution<double> uy(0.0, 0.45);
+	uniform_real_distribution<double> uz(-0.5, 0.0);
+	vector< shared_ptr<Particle> > spheres;
+	for(int k = 0; k < count; ++k) {
+		auto sphere = make_shared<Particle>();
+		sphere->r = count == 1 ? 0.1 : 0.1/cbrt((double)count);
+		sphere->x = Vector3d(ux(rng), uy(rng), uz(rng));
+		sphere->tare();
+		spheres.push_back(sphere);
+	}
+	return spheres;
+}
+
+static void run(const Config &config, int steps, ostream &out)
+{
+	const double h = 5e-3;
+	Vector3d grav(0.0, -9.8, 0.0);
+	Vector3d x00(-0.25, 0.5, 0.0);
+	Vector3d x01(0.25, 0.5, 0.0);
+	Vector3d x10(-0.25, 0.5, -0.5);
+	Vector3d x11(0.25, 0.5, -0.5);
+	auto cloth = make_shared<Cloth>(config.grid, config.grid, x00, x01, x10, x11, 0.1, config.stiffness);
+	cloth->setPreconditioner(config.precond);
+	cloth->setSolver(config.solver);
+	cloth->tare();
+	auto spheres = createSpheres(config.spheres);
+
+	for(int k = 0; k < WARMUP_STEPS; ++k) {
+		cloth->step(h, grav, spheres);
+	}
+	cloth->resetTimings();
+	long iterations = 0;
+	long estimates = 0;
+	int unconverged = 0;
+	auto t0 = chrono::steady_clock::now();
+	for(int k = 0; k < steps; ++k) {
+		cloth->step(h, grav, spheres);
+		iterations += cloth->getIterations();
+		estimates += cloth->getEstimateProducts();
+		if(!(cloth->getError() <= cloth->getTolerance())) {
+			++unconverged;
+		}
+	}
+	double total = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+
+	const Cloth::Timings &t = cloth->getTimings();
+	double ms = 1e3/steps;
+	ostringstream name;
+	name << "Cloth/grid:" << config.grid << "/spheres:" << config.spheres << "/stiffness:" << config.stiffness;
+	out << "    {\n";
+	out << "      \"name\": \"" << name.str() << "\",\n";
+	out << "      \"grid\": " << config.grid << ",\n";
+	out << "      \"particles\": " << cloth->getNumParticles() << ",\n";
+	out << "      \"spheres\": " << config.spheres << ",\n";
+	out << "      \"stiffness\": " << config.stiffness << ",\n";
+	out << "      \"iterations\": " << steps << ",\n";
+	out << "      \"real_time\": " << total*ms << ",\n";
+	out << "      \"time_unit\": \"ms\",\n";
+	out << "      \"collision_ms\": " << t.collision*ms << ",\n";
+	out << "      \"assembly_ms\": " << t.assembly*ms << ",\n";
+	out << "      \"compute_ms\": " << t.compute*ms << ",\n";
+	out << "      \"solve_ms\": " << t.solve*ms << ",\n";
+	out << "      \"buffers_ms\": " << t.buffers*ms << ",\n";
+	out << "      \"pattern_ms\": " << t.pattern*1e3 << ",\n";
+	out << "      \"solver_iterations\": " << (double)iterations/steps << ",\n";
+	out << "      \"estimate_products\": " << (double)estimates/steps << ",\n";
+	out << "      \"unconverged_steps\": " << unconverged << "\n";
+	out << "    }";
+}
+
+int main(int argc, char **argv)
+{
+	int steps = argc > 1 ? atoi(argv[1]) : 20;
+	int maxGrid = argc > 2 ? atoi(argv[2]) : 512;
+	ofstream file;
+	if(argc > 3 && string(argv[3]) != "-") {
+		file.open(argv[3]);
+		if(!file.good()) {
+			cerr << "Cannot write to " << argv[3] << endl;
+			return -1;
+		}
+	}
+	ostream &out = file.is_open() ? file : cout;
+	Cloth::Preconditioner precond = Cloth::JACOBI;
+	string precondName = argc > 4 ? argv[4] : "jacobi";
+	if(precondName == "block-jacobi") {
+		precond = Cloth::BLOCK_JACOBI;
+	} else if(precondName == "ic") {
+		precond = Cloth::INCOMPLETE_CHOLESKY;
+	} else if(precondName == "multigrid") {
+		precond = Cloth::MULTIGRID;
+	} else if(precondName != "jacobi") {
+		steps = 0;
+	}
+	Cloth::Solver solver = Cloth::CONJUGATE_GRADIENT;
+	string solverName = argc > 5 ? argv[5] : "cg";
+	if(solverName == "chebyshev") {
+		solver = Cloth::CHEBYSHEV;
+	} else if(solverName != "cg") {
+		steps = 0;
+	}
+	if(steps < 1) {
+		cout << "Usage: A5_bench [STEPS] [MAX_GRID] [OUTPUT] [PRECOND] [SOLVER]" << endl;
+		return 0;
+	}
+
+	vector<Config> configs;
+	for(int grid = 16; grid <= maxGrid; grid *= 2) {
+		for(int spheres = 1; spheres <= 1000; spheres *= 10) {
+			for(double stiffness = 1e1; stiffness <= 1e4; stiffness *= 10.0) {
+				configs.push_back(Config{grid, spheres, stiffness, precond, solver});
+			}
+		}
+	}
+
+	int threads = 1;
+#ifdef _OPENMP
+	threads = omp_get_max_threads();
+#endif
+	time_t now = time(nullptr);
+	char date[64];
+	strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", localtime(&now));
+	out << "{\n";
+	out << "  \"context\": {\n";
+	out << "    \"date\": \"" << date << "\",\n";
+	out << "    \"executable\": \"" << argv[0] << "\",\n";
+	out << "    \"num_threads\": " << threads << ",\n";
+	out << "    \"preconditioner\": \"" << precondName << "\",\n";
+	out << "    \"solver\": \"" << solverName << "\",\n";
+	out << "    \"steps\": " << steps << ",\n";
+	out << "    \"time_step\": 5e-3\n";
+	out << "  },\n";
+	out << "  \"benchmarks\": [\n";
+	for(int k = 0; k < (int)configs.size(); ++k) {
+		const Config &c = configs[k];
+		cerr << "grid " << c.grid << ", spheres " << c.spheres << ", stiffness " << c.stiffness << endl;
+		run(c, steps, out);
+		out << (k + 1 < (int)configs.size() ? ",\n" : "\n");
+		out.flush();
+	}
+	out << "  ]\n";
+	out << "}\n";
+	return 0;
+}